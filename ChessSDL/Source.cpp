@@ -2,9 +2,48 @@
 #include <SDL_image.h>
 #undef main
 #include <iostream>
-#include <list>
 #include <string>
 #include <random>
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 using namespace std;
 
 // BY PEYTON RYAN
@@ -19,31 +58,477 @@ bool fullscreen;
 void handleEvents();
 void update();
 void render();
-int* generateTables();
+int runCommand(int argc, char* argv[]);
+const unsigned long long* zobristKeys();
+vector<int> defaultTables();
 
 // Constants
 SDL_Color LIGHT_SQUARE = { 235, 200, 160 };
 SDL_Color DARK_SQUARE = { 162, 120, 60 };
 int BOARD_SIZE = 60;
-// Values of Pieces for evaluation
 int PIECE_IMAGE_SIZE = 60;
-int PAWN = 100;
-int KNIGHT = 300;
-int BISHOP = 300;
-int ROOK = 500;
-int QUEEN = 900;
-// Amount of moves to look ahead. Greater is better and slower
-int ENGINE_DEPTH = 4; 
+// Keys of every position in the game so far, followed by the positions on the current search path
+// Each search thread has its own copy
+thread_local vector<unsigned long long> key_history;
+// Search statistics beyond the node counts cost time in the hottest code, so release
+// builds leave them out unless SEARCH_STATS is defined. STAT(...) holds code that only
+// counts, and disappears with them
+#if !defined(NDEBUG) && !defined(SEARCH_STATS)
+#define SEARCH_STATS
+#endif
+#ifdef SEARCH_STATS
+#define STAT(x) x
+#else
+#define STAT(x)
+#endif
+// Builds with COUNT_ALLOCATIONS defined replace the global operator new and count every
+// call in the search, to check that the search below the root never goes to the heap.
+// ALLOC(...) holds code that only serves the count
+#ifdef COUNT_ALLOCATIONS
+#define ALLOC(x) x
+#else
+#define ALLOC(x)
+#endif
+// Allocation functions built on malloc and free are kept out of line, so callers only see
+// operator new paired with operator delete and the compiler does not flag a mismatch
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#elif defined(__GNUC__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
 
-int* tables = NULL;
-int num_evaluated = 0;
+// Work done by one thread in a search. Every thread counts its own, and adds them to its
+// engine's totals when it finishes, see Engine::addCounters
+struct SearchCounters
+{
+	long long nodes;
+	long long qnodes; // Positions visited by the quiescence search
+#ifdef SEARCH_STATS
+	// Positions skipped by each of the pruning techniques near the leaves
+	long long futility_pruned;
+	long long reverse_futility_pruned;
+	long long razored;
+	// Transposition table lookups, the ones that found the position and the ones whose
+	// score was enough to return without searching
+	long long tt_probes;
+	long long tt_hits;
+	long long tt_cutoffs;
+	// Beta cutoffs, and the ones made by the first move searched, a measure of move ordering
+	long long fail_highs;
+	long long first_move_fail_highs;
+#endif
+#ifdef COUNT_ALLOCATIONS
+	// Calls to operator new, and the ones made while searching below the root
+	long long allocations;
+	long long hot_allocations;
+#endif
+
+	void clear()
+	{
+		nodes = 0;
+		qnodes = 0;
+#ifdef SEARCH_STATS
+		futility_pruned = 0;
+		reverse_futility_pruned = 0;
+		razored = 0;
+		tt_probes = 0;
+		tt_hits = 0;
+		tt_cutoffs = 0;
+		fail_highs = 0;
+		first_move_fail_highs = 0;
+#endif
+#ifdef COUNT_ALLOCATIONS
+		allocations = 0;
+		hot_allocations = 0;
+#endif
+	}
+	// Every position visited, by the main search and the quiescence search
+	long long total() const
+	{
+		return nodes + qnodes;
+	}
+	void add(const SearchCounters& c)
+	{
+		nodes += c.nodes;
+		qnodes += c.qnodes;
+#ifdef SEARCH_STATS
+		futility_pruned += c.futility_pruned;
+		reverse_futility_pruned += c.reverse_futility_pruned;
+		razored += c.razored;
+		tt_probes += c.tt_probes;
+		tt_hits += c.tt_hits;
+		tt_cutoffs += c.tt_cutoffs;
+		fail_highs += c.fail_highs;
+		first_move_fail_highs += c.first_move_fail_highs;
+#endif
+#ifdef COUNT_ALLOCATIONS
+		allocations += c.allocations;
+		hot_allocations += c.hot_allocations;
+#endif
+	}
+};
+thread_local SearchCounters counters = SearchCounters();
+
+#ifdef COUNT_ALLOCATIONS
+// Whether the calling thread is searching below the root, see getBest
+thread_local bool hot_path = false;
+
+// Sets hot_path for the life of the object
+struct HotPath
+{
+	bool saved;
+
+	HotPath(bool on) : saved(hot_path)
+	{
+		hot_path = on;
+	}
+	~HotPath()
+	{
+		hot_path = saved;
+	}
+};
+
+// Counts one allocation. malloc itself cannot be replaced portably, so the engine only
+// calls it where it counts the call too, see BoardPool
+void countAllocation()
+{
+	counters.allocations++;
+	if (hot_path)
+	{
+		counters.hot_allocations++;
+	}
+}
+
+// Every form of operator new comes through here
+void* countedAlloc(size_t bytes)
+{
+	countAllocation();
+	return malloc(bytes == 0 ? 1 : bytes);
+}
+NOINLINE void* operator new(size_t bytes)
+{
+	void* p = countedAlloc(bytes);
+	if (p == NULL)
+	{
+		throw bad_alloc();
+	}
+	return p;
+}
+NOINLINE void* operator new[](size_t bytes)
+{
+	return operator new(bytes);
+}
+NOINLINE void* operator new(size_t bytes, const nothrow_t&) noexcept
+{
+	return countedAlloc(bytes);
+}
+NOINLINE void* operator new[](size_t bytes, const nothrow_t&) noexcept
+{
+	return countedAlloc(bytes);
+}
+NOINLINE void operator delete(void* p) noexcept
+{
+	free(p);
+}
+NOINLINE void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+NOINLINE void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+NOINLINE void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+NOINLINE void operator delete(void* p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+NOINLINE void operator delete[](void* p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+#endif
+
+// Optional timeline of what the search threads did, written in the Chrome trace event
+// format for chrome://tracing or Perfetto. Each thread records spans into its own ring
+// buffer without locks, overwriting the oldest when it is full. With tracing off a span
+// costs one relaxed load
+struct TraceEvent
+{
+	const char* name;
+	char detail[8]; // Short text shown with the span, such as the root move
+	int arg; // Depth or other number shown with the span
+	long long start_ns;
+	long long duration_ns; // -1 for an instant event
+};
+
+// Events of one thread. Only the owning thread writes, head is published after each
+// event so the buffer can be read once the thread is done
+struct TraceBuffer
+{
+	vector<TraceEvent> events;
+	atomic<unsigned long long> head;
+	const char* thread_name;
+	int id;
+};
+
+class Tracer {
+public:
+	atomic<bool> enabled;
+	chrono::steady_clock::time_point epoch;
+	size_t capacity; // Events kept per thread
+	mutex lock; // Held only to add a buffer
+	vector<unique_ptr<TraceBuffer>> buffers;
+
+	Tracer()
+	{
+		enabled = false;
+		capacity = 0;
+	}
+	// Starts recording, once per process. Buffers are kept until exit so the events of
+	// threads that have finished can still be written out
+	void start(size_t events_per_thread)
+	{
+		capacity = max((size_t)16, events_per_thread);
+		epoch = chrono::steady_clock::now();
+		enabled = true;
+	}
+	// Start time of a span, -1 when tracing is off
+	long long begin()
+	{
+		if (!enabled.load(memory_order_relaxed))
+		{
+			return -1;
+		}
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+	}
+	void end(const char* name, long long start, int arg = 0, const string& detail = "")
+	{
+		if (start >= 0)
+		{
+			record(name, start, begin() - start, arg, detail);
+		}
+	}
+	void instant(const char* name, int arg = 0, const string& detail = "")
+	{
+		long long now = begin();
+		if (now >= 0)
+		{
+			record(name, now, -1, arg, detail);
+		}
+	}
+	void record(const char* name, long long start, long long duration, int arg, const string& detail);
+	bool dump(const string& path);
+};
+Tracer tracer;
+thread_local TraceBuffer* trace_buffer = NULL;
+thread_local const char* trace_thread_name = "main";
+
+// Records the time from construction to the end of the scope
+struct TraceSpan
+{
+	const char* name;
+	int arg;
+	long long start;
+
+	TraceSpan(const char* n, int a = 0) : name(n), arg(a), start(tracer.begin()) {}
+	~TraceSpan()
+	{
+		tracer.end(name, start, arg);
+	}
+};
+
+void Tracer::record(const char* name, long long start, long long duration, int arg, const string& detail)
+{
+	if (trace_buffer == NULL)
+	{
+		trace_buffer = new TraceBuffer();
+		trace_buffer->events.resize(capacity);
+		trace_buffer->head = 0;
+		trace_buffer->thread_name = trace_thread_name;
+		lock_guard<mutex> l(lock);
+		trace_buffer->id = (int)buffers.size();
+		buffers.emplace_back(trace_buffer);
+	}
+	unsigned long long h = trace_buffer->head.load(memory_order_relaxed);
+	TraceEvent& e = trace_buffer->events[h % capacity];
+	e.name = name;
+	size_t n = detail.copy(e.detail, sizeof(e.detail) - 1);
+	e.detail[n] = 0;
+	e.arg = arg;
+	e.start_ns = start;
+	e.duration_ns = duration;
+	trace_buffer->head.store(h + 1, memory_order_release);
+}
+
+// Writes every buffer as a trace event file, times are microseconds with nanosecond decimals
+bool Tracer::dump(const string& path)
+{
+	ofstream out(path);
+	if (!out)
+	{
+		return false;
+	}
+#ifdef _WIN32
+	long long pid = GetCurrentProcessId();
+#else
+	long long pid = getpid();
+#endif
+	lock_guard<mutex> l(lock);
+	out << "{\"traceEvents\":[" << endl;
+	bool first = true;
+	for (auto& b : buffers)
+	{
+		out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << b->id << ",\"args\":{\"name\":\"" << b->thread_name << " " << b->id << "\"}}";
+		first = false;
+		unsigned long long head = b->head.load(memory_order_acquire);
+		for (unsigned long long i = head > capacity ? head - capacity : 0; i < head; i++)
+		{
+			TraceEvent& e = b->events[i % capacity];
+			out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"search\",\"pid\":" << pid << ",\"tid\":" << b->id;
+			out << ",\"ts\":" << e.start_ns / 1000 << "." << setw(3) << setfill('0') << e.start_ns % 1000 << setfill(' ');
+			if (e.duration_ns < 0)
+			{
+				out << ",\"ph\":\"i\",\"s\":\"t\"";
+			}
+			else
+			{
+				out << ",\"ph\":\"X\",\"dur\":" << e.duration_ns / 1000 << "." << setw(3) << setfill('0') << e.duration_ns % 1000 << setfill(' ');
+			}
+			out << ",\"args\":{\"n\":" << e.arg;
+			if (e.detail[0] != 0)
+			{
+				out << ",\"detail\":\"" << e.detail << "\"";
+			}
+			out << "}}";
+		}
+	}
+	out << endl << "]}" << endl;
+	return true;
+}
+
+// Memory held by each kind of engine data, for long running processes to watch
+enum MemoryCategory { MEM_BOARDS, MEM_HASH, MEM_TREE, MEM_TABLES, MEM_CATEGORIES };
+const char* MEMORY_CATEGORY_NAMES[MEM_CATEGORIES] = { "boards", "hash table", "search tree", "other tables" };
+
+// Bytes in use by category, now and at most so far. Threads gather changes locally and
+// publish them in steps of 64 KB so boards made in the search do not fight over one
+// counter, the figures are exact whenever the threads are idle
+class MemoryAccounting {
+public:
+	atomic<long long> current[MEM_CATEGORIES];
+	atomic<long long> peak[MEM_CATEGORIES];
+
+	MemoryAccounting()
+	{
+		for (int c = 0; c < MEM_CATEGORIES; c++)
+		{
+			current[c] = 0;
+			peak[c] = 0;
+		}
+	}
+	void publish(int c, long long bytes)
+	{
+		long long now = current[c].fetch_add(bytes, memory_order_relaxed) + bytes;
+		long long p = peak[c].load(memory_order_relaxed);
+		while (now > p && !peak[c].compare_exchange_weak(p, now, memory_order_relaxed))
+		{
+		}
+	}
+	void add(MemoryCategory c, long long bytes);
+	void flush();
+	long long total()
+	{
+		long long t = 0;
+		for (int c = 0; c < MEM_CATEGORIES; c++)
+		{
+			t += current[c].load(memory_order_relaxed);
+		}
+		return t;
+	}
+	// Leaves out categories nothing in this run has used, such as the search tree, which only
+	// MCTS fills
+	void report(ostream& out)
+	{
+		flush();
+		for (int c = 0; c < MEM_CATEGORIES; c++)
+		{
+			if (peak[c] == 0)
+			{
+				continue;
+			}
+			out << MEMORY_CATEGORY_NAMES[c] << ": " << current[c] / 1024 << " KB, peak " << peak[c] / 1024 << " KB" << endl;
+		}
+	}
+};
+MemoryAccounting memory;
+
+// Changes not yet published by the calling thread, published when the thread ends
+struct MemoryDelta
+{
+	long long bytes[MEM_CATEGORIES];
+
+	MemoryDelta()
+	{
+		for (int c = 0; c < MEM_CATEGORIES; c++)
+		{
+			bytes[c] = 0;
+		}
+	}
+	~MemoryDelta()
+	{
+		for (int c = 0; c < MEM_CATEGORIES; c++)
+		{
+			memory.publish(c, bytes[c]);
+		}
+	}
+};
+thread_local MemoryDelta memory_delta;
+
+void MemoryAccounting::add(MemoryCategory c, long long bytes)
+{
+	long long& d = memory_delta.bytes[c];
+	d += bytes;
+	if (d > 65536 || d < -65536)
+	{
+		publish(c, d);
+		d = 0;
+	}
+}
+
+// Publishes the calling thread's changes
+void MemoryAccounting::flush()
+{
+	for (int c = 0; c < MEM_CATEGORIES; c++)
+	{
+		publish(c, memory_delta.bytes[c]);
+		memory_delta.bytes[c] = 0;
+	}
+}
+
+// Whether this thread keeps the time for its engine's search
+thread_local bool main_thread = true;
+thread_local int ybwc_id = 0; // Index of this thread's deque in the YBWC backend
+
+// How the threads split the work, see think
+enum SearchBackend { LAZY_SMP, YBWC, MCTS };
+
+// Engine the calling thread is working for, see EngineScope
+class Engine;
+thread_local Engine* engine = NULL;
 
 // Object Declerations
 class Board;
 class Move;
 
-// Required Board Decleration first
-void freeBoard(Board*);
+// Kinds of node in the search tree. Root and PV nodes are searched with a full window,
+// every other node only has to prove whether a move beats alpha
+enum NodeType { ROOT, PV, NON_PV };
 
 // Used to store information about a given move
 class Move {
@@ -52,7 +537,7 @@ public:
 	int from_y;
 	int to_x;
 	int to_y;
-	// What piece to promote to, if pawn at end
+	// What piece to promote to, if pawn at end. 0 for a queen, else the piece code (2 bishop, 3 knight, 4 rook)
 	int promotion_piece;
 	// What file en_passant is possible on, if any
 	int en_passant;
@@ -74,56 +559,722 @@ public:
 		black_castling_l = bcl;
 		black_castling_r = bcr;
 	}
+	Move() : Move(0, 0, 0, 0, false, false, false, false) {}
 };
 
+// Most legal moves any chess position has is 218
+const int MAX_MOVES = 256;
+
+// Legal moves of a board, kept inside the board so finding them never touches the heap.
+// Only the moves in use are copied, the rest of the storage is left uninitialised
+class MoveList {
+	alignas(Move) unsigned char storage[MAX_MOVES * sizeof(Move)];
+	int count;
 
-// Object for a given position. Used to hold give position as well
-// as test future positions
-class Board {
 public:
-	list<Move*> *moves; // List of legal moves
-	bool turn;
-	bool white_check;
-	bool black_check;
-	int ** squares; // Holds piece values
-	bool white_castling_l;
-	bool white_castling_r;
-	bool black_castling_l;
-	bool black_castling_r;
-	int move_num;
-	int en_passant;
-	int depth;
-	int eval;
+	typedef Move* iterator;
 
-	// Constructor, takes in a fen string (notation for chess position) and sets up the board
-	Board(string fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR", int mn = 1) {
-		turn = true;
-		white_check = false;
-		black_check = false;
-		move_num = mn;
-		en_passant = -1;
-		depth = 1;
-		squares = new int*[8];
-		moves = new list<Move*>;
-		// Initialize board
-		for (int x = 0; x < 8; x++)
+	MoveList() : count(0) {}
+	MoveList(const MoveList& l) : count(l.count)
+	{
+		memcpy(storage, l.storage, count * sizeof(Move));
+	}
+	MoveList& operator=(const MoveList& l)
+	{
+		count = l.count;
+		memcpy(storage, l.storage, count * sizeof(Move));
+		return *this;
+	}
+	Move* begin() { return reinterpret_cast<Move*>(storage); }
+	Move* end() { return begin() + count; }
+	const Move* begin() const { return reinterpret_cast<const Move*>(storage); }
+	const Move* end() const { return begin() + count; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	Move& back() { return begin()[count - 1]; }
+	void clear() { count = 0; }
+	void push_back(const Move& m)
+	{
+		new (begin() + count++) Move(m);
+	}
+	// Moves i to the front, the moves before it keep their order
+	void moveToFront(iterator i)
+	{
+		rotate(begin(), i, i + 1);
+	}
+};
+
+// Principal variation, the line of best moves found from each ply of the search
+const int MAX_PLY = 64;
+thread_local Move pv_table[MAX_PLY][MAX_PLY];
+thread_local int pv_length[MAX_PLY];
+// Deepest search the engine will run, leaves the principal variation room to spare
+const int MAX_DEPTH = MAX_PLY - 16;
+
+// Thread placement and hash table memory, defined once Engine is known
+void pinThread(int index);
+void* allocLarge(size_t bytes, bool& huge, MemoryCategory category);
+void freeLarge(void* p, size_t bytes, MemoryCategory category);
+void parallelSlices(size_t count, function<void(size_t, size_t)> work);
+
+// Transposition table shared by every search thread without locks
+// Each entry stores its data next to key ^ data, so an entry torn by two threads
+// writing at once no longer matches any key and is treated as a miss
+const int TT_EXACT = 0;
+const int TT_LOWER = 1; // Score is at least this much (beta cutoff)
+const int TT_UPPER = 2; // Score is at most this much (no move beat alpha)
+
+struct TTEntry
+{
+	atomic<unsigned long long> check;
+	atomic<unsigned long long> data;
+};
+
+class TranspositionTable {
+public:
+	TTEntry* entries;
+	size_t size;
+	bool huge; // Backed by large pages
+	string shared_name; // Shared memory segment holding the entries, empty for a private table
+
+	TranspositionTable()
+	{
+		entries = NULL;
+		size = 0;
+		huge = false;
+	}
+	~TranspositionTable()
+	{
+		release();
+	}
+	void release()
+	{
+#ifndef _WIN32
+		if (!shared_name.empty())
 		{
-			squares[x] = new int[8];
-			for (int y = 0; y < 8; y++)
+			munmap(entries, size * sizeof(TTEntry));
+			memory.add(MEM_HASH, -(long long)(size * sizeof(TTEntry)));
+			shared_name.clear();
+			entries = NULL;
+			size = 0;
+			return;
+		}
+#endif
+		freeLarge(entries, size * sizeof(TTEntry), MEM_HASH);
+		entries = NULL;
+		size = 0;
+	}
+	void resize(int mb)
+	{
+		TraceSpan span("hash resize", mb);
+		release();
+		size = 1;
+		while (size * 2 * sizeof(TTEntry) <= (size_t)mb * 1024 * 1024)
+		{
+			size *= 2;
+		}
+		entries = (TTEntry*)allocLarge(size * sizeof(TTEntry), huge, MEM_HASH);
+		clear();
+	}
+	// Puts the table in the named POSIX shared memory segment so other engine processes on the
+	// host can attach to it and share results. The first process makes the segment with mb
+	// megabytes, later ones take the size it already has. Entries are lockless either way.
+	// The segment stays until removeShared, so processes can come and go
+	// Returns false if shared memory is not available, the table is left as it was
+	bool attach(const string& name, int mb)
+	{
+#ifdef _WIN32
+		return false;
+#else
+		string path = name[0] == '/' ? name : "/" + name;
+		size_t want = 1;
+		while (want * 2 * sizeof(TTEntry) <= (size_t)mb * 1024 * 1024)
+		{
+			want *= 2;
+		}
+		bool created = true;
+		int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd == -1)
+		{
+			created = false;
+			fd = shm_open(path.c_str(), O_RDWR, 0600);
+		}
+		if (fd == -1)
+		{
+			return false;
+		}
+		size_t bytes = want * sizeof(TTEntry);
+		if (created)
+		{
+			if (ftruncate(fd, bytes) != 0)
+			{
+				close(fd);
+				shm_unlink(path.c_str());
+				return false;
+			}
+		}
+		else
+		{
+			// The creator may not have set the size yet
+			struct stat st;
+			st.st_size = 0;
+			for (int tries = 0; tries < 1000 && fstat(fd, &st) == 0 && st.st_size == 0; tries++)
+			{
+				this_thread::sleep_for(chrono::milliseconds(1));
+			}
+			if (st.st_size < (off_t)sizeof(TTEntry))
+			{
+				close(fd);
+				return false;
+			}
+			want = 1;
+			while (want * 2 * sizeof(TTEntry) <= (size_t)st.st_size)
 			{
-				squares[x][y] = NULL;
+				want *= 2;
 			}
+			bytes = want * sizeof(TTEntry);
 		}
+		void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+		{
+			return false;
+		}
+		release();
+		entries = (TTEntry*)p;
+		size = want;
+		memory.add(MEM_HASH, bytes);
+		huge = false;
+		shared_name = path;
+		// A new segment is already zero, which is an empty table
+		if (created)
+		{
+			for (size_t i = 0; i < size; i++)
+			{
+				new (&entries[i]) TTEntry();
+			}
+		}
+		return true;
+#endif
+	}
+	static void removeShared(const string& name)
+	{
+#ifndef _WIN32
+		shm_unlink((name[0] == '/' ? name : "/" + name).c_str());
+#endif
+	}
+	// Data layout: score in the low 32 bits, then 8 bits depth, 2 bits bound and 13 bits best move
+	bool probe(unsigned long long key, int& score, int& depth, int& bound, int& move)
+	{
+		TTEntry& e = entries[key & (size - 1)];
+		unsigned long long data = e.data.load(memory_order_relaxed);
+		if ((e.check.load(memory_order_relaxed) ^ data) != key)
+		{
+			return false;
+		}
+		score = (int)(unsigned int)(data & 0xFFFFFFFF);
+		depth = (int)((data >> 32) & 0xFF);
+		bound = (int)((data >> 40) & 0x3);
+		move = (int)((data >> 42) & 0x1FFF);
+		return true;
+	}
+	void store(unsigned long long key, int score, int depth, int bound, Move* m)
+	{
+		TTEntry& e = entries[key & (size - 1)];
+		int move = 0;
+		if (m != NULL)
+		{
+			move = m->from_x | (m->from_y << 3) | (m->to_x << 6) | (m->to_y << 9) | (1 << 12);
+		}
+		unsigned long long data = (unsigned long long)(unsigned int)score | ((unsigned long long)depth << 32) | ((unsigned long long)bound << 40) | ((unsigned long long)move << 42);
+		e.check.store(key ^ data, memory_order_relaxed);
+		e.data.store(data, memory_order_relaxed);
+	}
+	// Also constructs the entries, spread over the search threads
+	void clear()
+	{
+		TraceSpan span("hash clear", (int)(size * sizeof(TTEntry) / (1024 * 1024)));
+		TTEntry* e = entries;
+		parallelSlices(size, [e](size_t first, size_t last)
+		{
+			for (size_t i = first; i < last; i++)
+			{
+				new (&e[i]) TTEntry();
+				e[i].check.store(0, memory_order_relaxed);
+				e[i].data.store(0, memory_order_relaxed);
+			}
+		});
+	}
+};
+class MCTSSearch;
 
+// Everything one engine instance owns: settings, hash table, search state and the game position
+// Several engines can search at once on different threads. Code below reaches the engine of
+// the thread it runs on through the engine pointer, so every thread an engine starts sets it
+class Engine {
+public:
+	// Amount of moves to look ahead. Greater is better and slower
+	int depth;
+	// Milliseconds the engine may think per move, 0 to always search to depth
+	int time_ms;
+	// Main thread nodes per search, 0 for no limit. Stops like time_ms does
+	long long node_limit;
+	// Threads searching at once, helpers share results through the transposition table
+	int threads;
+	// Size of the transposition table in megabytes
+	int hash_mb;
+	// Thread and memory placement: pin each search thread to its own core, spread them
+	// over NUMA nodes instead of filling one node first, and back hash tables with 2 MB pages
+	bool pin_threads;
+	bool numa_interleave;
+	bool large_pages;
+	SearchBackend backend;
+	// Nodes with less depth than this are searched by one thread in the YBWC backend
+	int ybwc_min_split_depth;
+	// Monte-Carlo tree search settings, playouts per move are used when time_ms is 0
+	int mcts_playouts;
+	int mcts_pool_size; // Nodes in the tree, kept between moves
+	double mcts_cpuct; // Weight of the prior against the average result
+	// Extra material a capture must be able to win in quiescence before it is searched
+	int delta_margin;
+	// Pruning margins near the leaves, indexed by remaining depth (1 to 3)
+	int futility_margin[4];
+	int reverse_futility_margin[4];
+	int razor_margin[4];
+	// Values of pieces for evaluation, and the piece square tables added to them
+	int pawn;
+	int knight;
+	int bishop;
+	int rook;
+	int queen;
+	vector<int> tables;
 
-		// For each character in fen, add piece to board
-		int y = 0;
-		for (int x = 0; x < fen.length(); x++)
-		{
-			switch (fen[x]) {
-			case '/':
-				continue;
-			case 'r':
+	TranspositionTable tt;
+	MCTSSearch* mcts; // Tree kept between moves, made on first use
+	// Search control, set by the main search thread when time runs out
+	atomic<bool> stop;
+	chrono::steady_clock::time_point search_start;
+	// Counters of every thread in the last search, and how long it took
+	SearchCounters totals;
+	mutex totals_lock;
+	long long search_ms;
+#ifdef SEARCH_STATS
+	// Nodes of the main thread after each finished iteration of the last search
+	vector<long long> depth_nodes;
+	vector<long long> depth_ms;
+#endif
+	// Best line and score of the last finished iteration of think
+	vector<Move> search_line;
+	int search_eval;
+
+	// The game being played, and the keys of every position in it
+	unique_ptr<Board> board;
+	vector<unsigned long long> history;
+
+	Engine();
+	~Engine();
+	Engine(const Engine&) = delete;
+	Engine& operator=(const Engine&) = delete;
+	// Applies settings written as name=value pairs split by commas, such as
+	// "depth=6,nodes=20000,backend=ybwc". Returns false on a name it does not know
+	bool configure(const string& options);
+	void setPosition(const string& fen);
+	// Starts a game from the position with nothing remembered from earlier searches
+	void newGame(const string& fen);
+	// Plays a move from the list of legal moves, false if it is not there
+	bool play(Move* m);
+	// Searches the current position without playing the result
+	Move go();
+	// Prints the counters and timings of the last search
+	void printStats(ostream& out);
+	// Adds the calling thread's counters to totals and clears them
+	void addCounters()
+	{
+		lock_guard<mutex> l(totals_lock);
+		totals.add(counters);
+		counters.clear();
+	}
+};
+
+// Makes e the engine of the calling thread until the end of the scope
+struct EngineScope
+{
+	Engine* saved;
+
+	EngineScope(Engine* e)
+	{
+		saved = engine;
+		engine = e;
+	}
+	~EngineScope()
+	{
+		engine = saved;
+	}
+};
+
+// CPUs in the order search threads are placed on them, one list per NUMA node read from sysfs
+vector<int> cpuOrder(bool interleave)
+{
+	vector<vector<int>> nodes;
+#ifdef __linux__
+	for (int n = 0; n < 64; n++)
+	{
+		ifstream f("/sys/devices/system/node/node" + to_string(n) + "/cpulist");
+		string ranges, range;
+		if (!f || !getline(f, ranges))
+		{
+			continue;
+		}
+		// Format is a comma separated list of cpus and ranges, e.g. 0-3,8-11
+		vector<int> cpus;
+		istringstream list(ranges);
+		while (getline(list, range, ','))
+		{
+			size_t dash = range.find('-');
+			int first = atoi(range.c_str());
+			int last = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+			for (int c = first; c <= last; c++)
+			{
+				cpus.push_back(c);
+			}
+		}
+		if (!cpus.empty())
+		{
+			nodes.push_back(cpus);
+		}
+	}
+#endif
+	if (nodes.empty())
+	{
+		nodes.push_back(vector<int>());
+		for (int c = 0; c < (int)max(1u, thread::hardware_concurrency()); c++)
+		{
+			nodes[0].push_back(c);
+		}
+	}
+	vector<int> order;
+	if (interleave)
+	{
+		// Round robin over the nodes
+		for (int i = 0; order.size() < (size_t)thread::hardware_concurrency() || i == 0; i++)
+		{
+			bool added = false;
+			for (auto& n : nodes)
+			{
+				if (i < (int)n.size())
+				{
+					order.push_back(n[i]);
+					added = true;
+				}
+			}
+			if (!added)
+			{
+				break;
+			}
+		}
+	}
+	else
+	{
+		for (auto& n : nodes)
+		{
+			order.insert(order.end(), n.begin(), n.end());
+		}
+	}
+	return order;
+}
+
+// Pins the calling thread to the index'th cpu in cpuOrder when the engine asks for it
+void pinThread(int index)
+{
+	if (!engine->pin_threads)
+	{
+		return;
+	}
+	static vector<int> compact = cpuOrder(false);
+	static vector<int> interleaved = cpuOrder(true);
+	vector<int>& order = engine->numa_interleave ? interleaved : compact;
+	int cpu = order[index % order.size()];
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#elif defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (cpu % (8 * sizeof(DWORD_PTR))));
+#endif
+}
+
+// Memory for hash tables, backed by 2 MB pages when the engine asks for them and the system allows it
+// Falls back to normal pages, huge is set to whether large pages were used. Memory starts zeroed
+void* allocPages(size_t bytes, bool& huge)
+{
+	huge = false;
+#ifdef _WIN32
+	if (engine->large_pages && GetLargePageMinimum() > 0)
+	{
+		// Large pages need the lock pages in memory privilege, which has to be switched on first
+		HANDLE token;
+		TOKEN_PRIVILEGES tp;
+		if (OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		{
+			if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid))
+			{
+				tp.PrivilegeCount = 1;
+				tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+				AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL);
+			}
+			CloseHandle(token);
+		}
+		size_t page = GetLargePageMinimum();
+		void* p = VirtualAlloc(NULL, (bytes + page - 1) / page * page, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (p != NULL)
+		{
+			huge = true;
+			return p;
+		}
+	}
+	return VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	const size_t page = 2 * 1024 * 1024;
+	size_t size = (bytes + page - 1) / page * page;
+#ifdef MAP_HUGETLB
+	// Explicit huge pages, only there if the administrator reserved some
+	if (engine->large_pages)
+	{
+		void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			huge = true;
+			return p;
+		}
+	}
+#endif
+	// Otherwise ask for transparent huge pages on a 2 MB aligned range
+	char* raw = (char*)mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+	{
+		return NULL;
+	}
+	char* p = (char*)(((size_t)raw + page - 1) / page * page);
+	if (p > raw)
+	{
+		munmap(raw, p - raw);
+	}
+	munmap(p + size, (raw + size + page) - (p + size));
+#ifdef MADV_HUGEPAGE
+	if (engine->large_pages && madvise(p, size, MADV_HUGEPAGE) == 0)
+	{
+		huge = true;
+	}
+#endif
+	return p;
+#endif
+}
+
+void* allocLarge(size_t bytes, bool& huge, MemoryCategory category)
+{
+	void* p = allocPages(bytes, huge);
+	if (p != NULL)
+	{
+		memory.add(category, bytes);
+	}
+	return p;
+}
+
+void freeLarge(void* p, size_t bytes, MemoryCategory category)
+{
+	if (p == NULL)
+	{
+		return;
+	}
+	memory.add(category, -(long long)bytes);
+#ifdef _WIN32
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	const size_t page = 2 * 1024 * 1024;
+	munmap(p, (bytes + page - 1) / page * page);
+#endif
+}
+
+// Runs work over count items split into one slice per search thread
+// With pinned threads the pages of each slice are first touched on that thread's NUMA node
+void parallelSlices(size_t count, function<void(size_t, size_t)> work)
+{
+	int threads = max(1, engine->threads);
+	Engine* e = engine;
+	vector<thread> pool;
+	for (int i = 0; i < threads; i++)
+	{
+		size_t first = count * i / threads;
+		size_t last = count * (i + 1) / threads;
+		pool.push_back(thread([=]()
+		{
+			EngineScope scope(e);
+			pinThread(i);
+			work(first, last);
+		}));
+	}
+	for (auto& t : pool)
+	{
+		t.join();
+	}
+}
+
+// Material value of a piece, used for capture ordering and exchanges
+int pieceValue(int piece)
+{
+	switch (piece % 10)
+	{
+	case 1:
+		return engine->pawn;
+	case 2:
+		return engine->bishop;
+	case 3:
+		return engine->knight;
+	case 4:
+		return engine->rook;
+	case 5:
+		return engine->queen;
+	case 6:
+		return 10000;
+	}
+	return 0;
+}
+
+
+// Stops the search once the main thread has used up its time or nodes
+void checkTime()
+{
+	if (main_thread && engine->time_ms > 0 && (counters.total() & 255) == 0 && chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - engine->search_start).count() >= engine->time_ms)
+	{
+		engine->stop = true;
+		tracer.instant("time up", engine->time_ms);
+	}
+	if (main_thread && engine->node_limit > 0 && counters.total() >= engine->node_limit && !engine->stop)
+	{
+		engine->stop = true;
+		tracer.instant("nodes up", (int)engine->node_limit);
+	}
+}
+
+// Name of a move in coordinate notation, e.g. e2e4
+string moveName(Move* m)
+{
+	string name;
+	name += (char)('a' + m->from_x);
+	name += (char)('8' - m->from_y);
+	name += (char)('a' + m->to_x);
+	name += (char)('8' - m->to_y);
+	if (m->promotion_piece != 0)
+	{
+		name += "  bnr"[m->promotion_piece];
+	}
+	return name;
+}
+
+
+// Boards freed by a thread, kept for its next new Board so the search stops asking the
+// heap for memory once it is deep enough. A board can be freed on another thread than the
+// one that made it, it then joins that thread's list. Handed back when the thread ends
+struct BoardPool
+{
+	struct Block
+	{
+		Block* next;
+	};
+	Block* head;
+	int count;
+
+	BoardPool() : head(NULL), count(0) {}
+	// Fills the pool up to n blocks of the given size before a search, so even its first
+	// descent takes no memory from the heap
+	void reserve(size_t bytes, int n)
+	{
+		while (count < n)
+		{
+			Block* block = static_cast<Block*>(allocate(bytes));
+			block->next = head;
+			head = block;
+			count++;
+		}
+	}
+	// Blocks come from malloc and go back with free, whichever operator new is in use
+	static void* allocate(size_t bytes)
+	{
+		ALLOC(countAllocation());
+		void* p = malloc(bytes);
+		if (p == NULL)
+		{
+			throw bad_alloc();
+		}
+		return p;
+	}
+	~BoardPool()
+	{
+		while (head != NULL)
+		{
+			Block* next = head->next;
+			free(head);
+			head = next;
+		}
+	}
+};
+thread_local BoardPool board_pool;
+const int BOARD_POOL_MAX = 4096; // Boards beyond this go straight back to the heap
+
+// Object for a given position. Used to hold give position as well
+// as test future positions
+class Board {
+public:
+	MoveList moves; // List of legal moves
+	bool turn;
+	bool white_check;
+	bool black_check;
+	int squares[8][8]; // Holds piece values
+	bool white_castling_l;
+	bool white_castling_r;
+	bool black_castling_l;
+	bool black_castling_r;
+	int move_num;
+	int halfmove; // Moves since the last capture or pawn move, for the fifty move rule
+	unsigned long long key; // Zobrist hash of the position
+	int en_passant;
+	int depth;
+	int ply; // Distance from the root of the current search
+	int eval;
+
+	// Constructor, takes in a fen string (notation for chess position) and sets up the board
+	// Only the piece placement is required, the side to move, castling, en passant and move
+	// counter fields are read when they are given
+	Board(string fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR", int mn = 1) {
+		turn = true;
+		white_check = false;
+		black_check = false;
+		move_num = mn;
+		halfmove = 0;
+		en_passant = -1;
+		depth = 1;
+		ply = 0;
+		memory.add(MEM_BOARDS, sizeof(Board));
+		// Initialize board
+		for (int x = 0; x < 8; x++)
+		{
+			for (int y = 0; y < 8; y++)
+			{
+				squares[x][y] = 0;
+			}
+		}
+
+
+		// For each character in fen, add piece to board
+		int y = 0;
+		int x;
+		for (x = 0; x < fen.length() && fen[x] != ' '; x++)
+		{
+			switch (fen[x]) {
+			case '/':
+				continue;
+			case 'r':
 				squares[y % 8][y / 8] = 4;
 				y++;
 				break;
@@ -211,14 +1362,68 @@ public:
 				white_castling_r = true;
 			}
 		}
+
+		// Remaining fields of a full fen string
+		string side, castling, ep;
+		istringstream fields(fen.substr(x));
+		if (fields >> side)
+		{
+			turn = side != "b";
+		}
+		if (fields >> castling)
+		{
+			white_castling_l = white_castling_l && castling.find('Q') != string::npos;
+			white_castling_r = white_castling_r && castling.find('K') != string::npos;
+			black_castling_l = black_castling_l && castling.find('q') != string::npos;
+			black_castling_r = black_castling_r && castling.find('k') != string::npos;
+		}
+		if (fields >> ep && ep != "-")
+		{
+			en_passant = ep[0] - 'a';
+		}
+		if (fields >> halfmove)
+		{
+			fields >> move_num;
+		}
 		evaluate(); // Evaluates given position by itself
+		computeKey();
 		findMoves(); // Calculates all legal moves from position
 	};
+	// Constructor used to copy a board, so another thread can search it
+	Board(Board* b)
+	{
+		turn = b->turn;
+		white_check = b->white_check;
+		black_check = b->black_check;
+		white_castling_l = b->white_castling_l;
+		white_castling_r = b->white_castling_r;
+		black_castling_l = b->black_castling_l;
+		black_castling_r = b->black_castling_r;
+		move_num = b->move_num;
+		halfmove = b->halfmove;
+		key = b->key;
+		en_passant = b->en_passant;
+		depth = b->depth;
+		ply = b->ply;
+		eval = b->eval;
+		memory.add(MEM_BOARDS, sizeof(Board));
+		memcpy(squares, b->squares, sizeof(squares));
+		moves = b->moves;
+	}
 	// Constructor used to create a board from another, with a move played
 	Board(Board * b, int from_x, int from_y, int to_x, int to_y, bool bcl, bool bcr, bool wcl, bool wcr, int piece = 0, int ep = -1, int d = 1)
 	{
 		turn = !(b->turn);
-		move_num = b->move_num++;
+		move_num = b->turn ? b->move_num : b->move_num + 1;
+		// Pawn moves and captures are irreversible and reset the fifty move count
+		if (b->squares[from_x][from_y] % 10 == 1 || b->squares[to_x][to_y] != 0)
+		{
+			halfmove = 0;
+		}
+		else
+		{
+			halfmove = b->halfmove + 1;
+		}
 		white_check = false;
 		black_check = false;
 		en_passant = ep;
@@ -227,16 +1432,9 @@ public:
 		black_castling_l = bcl;
 		black_castling_r = bcr;
 		depth = d;
-		squares = new int* [8];
-		moves = new list<Move*>;
-		for (int x = 0; x < 8; x++)
-		{
-			squares[x] = new int[8];
-			for (int y = 0; y < 8; y++)
-			{
-				squares[x][y] = b->squares[x][y];
-			}
-		}
+		ply = b->ply + 1;
+		memory.add(MEM_BOARDS, sizeof(Board));
+		memcpy(squares, b->squares, sizeof(squares));
 		if (from_x != to_x || from_y != to_y)
 		{
 			// Check for special moves
@@ -280,25 +1478,59 @@ public:
 		}
 		if ((to_y == 0 || to_y == 7) && squares[to_x][to_y] % 10 == 1) // If Pawn made it to end
 		{
-			switch (piece)
-			{
-			case 0: // Queen
-				squares[to_x][to_y] += 4;
-			}
+			// piece is the code of the new piece, 0 for a queen
+			squares[to_x][to_y] += (piece == 0 ? 5 : piece) - 1;
 		}
 		evaluate(); // Evaluate given position
-		if(depth > 0) // Moves are not needed if position is only being used to determine check
+		key = 0;
+		if (depth > 0) // Moves are not needed if position is only being used to determine check
+		{
+			computeKey();
 			findMoves();
+		}
+	}
+	// The move list frees itself
+	~Board()
+	{
+		memory.add(MEM_BOARDS, -(long long)sizeof(Board));
+	}
+	Board(const Board&) = delete;
+	Board& operator=(const Board&) = delete;
+	// Boards come from the calling thread's BoardPool when it has one
+	static NOINLINE void* operator new(size_t bytes)
+	{
+		BoardPool& pool = board_pool;
+		if (pool.head == NULL)
+		{
+			return BoardPool::allocate(bytes);
+		}
+		BoardPool::Block* block = pool.head;
+		pool.head = block->next;
+		pool.count--;
+		return block;
+	}
+	static NOINLINE void operator delete(void* p)
+	{
+		BoardPool& pool = board_pool;
+		if (pool.count >= BOARD_POOL_MAX)
+		{
+			free(p);
+			return;
+		}
+		BoardPool::Block* block = static_cast<BoardPool::Block*>(p);
+		block->next = pool.head;
+		pool.head = block;
+		pool.count++;
 	}
 	Board* doMove(int from_xi, int from_yi, int to_xi, int to_yi, int piece = 0)
 	{
 		// If a move is attempted to be played, check if it is in the list of calculated moves
-		for (list<Move*>::iterator i = moves->begin(); i != moves->end(); i++)
+		for (MoveList::iterator i = moves.begin(); i != moves.end(); i++)
 		{
-			if (from_xi == (*i)->from_x && from_yi == (*i)->from_y && to_xi == (*i)->to_x && to_yi == (*i)->to_y && piece == (*i)->promotion_piece)
+			if (from_xi == i->from_x && from_yi == i->from_y && to_xi == i->to_x && to_yi == i->to_y && piece == i->promotion_piece)
 			{
 				// If it is a valid move, play it and return the new board
-				return new Board(this, (*i)->from_x, (*i)->from_y, (*i)->to_x, (*i)->to_y, (*i)->black_castling_l, (*i)->black_castling_r, (*i)->white_castling_l, (*i)->white_castling_r, (*i)->promotion_piece, (*i)->en_passant);
+				return new Board(this, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant);
 			}
 		}
 		return this;
@@ -321,7 +1553,7 @@ public:
 					case 1: // Black Pawn
 						if (squares[x][y + 1] == 0)
 						{
-							checkMove(x, y, x, y + 1, black_castling_l, black_castling_r, white_castling_l, white_castling_r);
+							checkPawnMove(x, y, x, y + 1);
 							if (y == 1 && squares[x][y + 2] == 0)
 							{
 								// First move double
@@ -329,19 +1561,19 @@ public:
 							}
 						}
 						// Take Piece
-						if (x > 0 && (squares[x - 1][y + 1] > 10 || en_passant == x - 1))
+						if (x > 0 && (squares[x - 1][y + 1] > 10 || (en_passant == x - 1 && y == 4)))
 						{
-							checkMove(x, y, x - 1, y + 1, black_castling_l, black_castling_r, white_castling_l, white_castling_r);
+							checkPawnMove(x, y, x - 1, y + 1);
 						}
-						if (x < 7 && (squares[x + 1][y + 1] > 10 || en_passant == x + 1))
+						if (x < 7 && (squares[x + 1][y + 1] > 10 || (en_passant == x + 1 && y == 4)))
 						{
-							checkMove(x, y, x + 1, y + 1, black_castling_l, black_castling_r, white_castling_l, white_castling_r);
+							checkPawnMove(x, y, x + 1, y + 1);
 						}
 						break;
 					case 11: // White Pawn
 						if (squares[x][y - 1] == 0)
 						{
-							checkMove(x, y, x, y - 1, black_castling_l, black_castling_r, white_castling_l, white_castling_r);
+							checkPawnMove(x, y, x, y - 1);
 							if (y == 6 && squares[x][y - 2] == 0)
 							{
 								// First move double
@@ -349,13 +1581,13 @@ public:
 							}
 						}
 						// Take Piece
-						if (x > 0 && ((squares[x - 1][y - 1] > 0 && squares[x - 1][y - 1] < 10) || en_passant == x - 1))
+						if (x > 0 && ((squares[x - 1][y - 1] > 0 && squares[x - 1][y - 1] < 10) || (en_passant == x - 1 && y == 3)))
 						{
-							checkMove(x, y, x - 1, y - 1, black_castling_l, black_castling_r, white_castling_l, white_castling_r);
+							checkPawnMove(x, y, x - 1, y - 1);
 						}
-						if (x < 7 && ((squares[x + 1][y - 1] > 0 && squares[x + 1][y - 1] < 10) || en_passant == x + 1))
+						if (x < 7 && ((squares[x + 1][y - 1] > 0 && squares[x + 1][y - 1] < 10) || (en_passant == x + 1 && y == 3)))
 						{
-							checkMove(x, y, x + 1, y - 1, black_castling_l, black_castling_r, white_castling_l, white_castling_r);
+							checkPawnMove(x, y, x + 1, y - 1);
 						}
 						break;
 					case 2: // Black Bishop
@@ -552,26 +1784,22 @@ public:
 							}
 						}
 						// Castle Left
-						if (black_castling_l && !isCheck(turn) && squares[x - 1][y] == 0 && squares[x - 2][y] == 0)
+						if (black_castling_l && !isCheck(turn) && squares[x - 1][y] == 0 && squares[x - 2][y] == 0 && squares[x - 3][y] == 0)
 						{
-							Board* a = new Board(this, x, y, x - 1, y, true, true, white_castling_l, white_castling_r, 0, -1, 0);
-							Board* b = new Board(this, x, y, x - 2, y, true, true, white_castling_l, white_castling_r, 0, -1, 0);
-							if (!(a->isCheck(turn) || b->isCheck(turn)))
+							Board a(this, x, y, x - 1, y, true, true, white_castling_l, white_castling_r, 0, -1, 0);
+							Board b(this, x, y, x - 2, y, true, true, white_castling_l, white_castling_r, 0, -1, 0);
+							if (!(a.isCheck(turn) || b.isCheck(turn)))
 							{
-								freeBoard(a);
-								freeBoard(b);
 								checkMove(x, y, x - 2, y, false, false, white_castling_l, white_castling_r);
 							}
 						}
 						// Castle Right
 						if (black_castling_r && !isCheck(turn) && squares[x + 1][y] == 0 && squares[x + 2][y] == 0)
 						{
-							Board* a = new Board(this, x, y, x + 1, y, true, true, white_castling_l, white_castling_r, 0, -1, 0);
-							Board* b = new Board(this, x, y, x + 2, y, true, true, white_castling_l, white_castling_r,  0, -1, 0);
-							if (!(a->isCheck(turn) || b->isCheck(turn)))
+							Board a(this, x, y, x + 1, y, true, true, white_castling_l, white_castling_r, 0, -1, 0);
+							Board b(this, x, y, x + 2, y, true, true, white_castling_l, white_castling_r,  0, -1, 0);
+							if (!(a.isCheck(turn) || b.isCheck(turn)))
 							{
-								freeBoard(a);
-								freeBoard(b);
 								checkMove(x, y, x + 2, y, false, false, white_castling_l, white_castling_r);
 							}
 						}
@@ -600,15 +1828,13 @@ public:
 							}
 						}
 						// Castle Left
-						if (white_castling_l && !isCheck(turn) && squares[x - 1][y] == 0 && squares[x - 2][y] == 0)
+						if (white_castling_l && !isCheck(turn) && squares[x - 1][y] == 0 && squares[x - 2][y] == 0 && squares[x - 3][y] == 0)
 						{
 							// Cannot Castle Through Check
-							Board* a = new Board(this, x, y, x - 1, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
-							Board* b = new Board(this, x, y, x - 2, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
-							if (!(a->isCheck(turn) || b->isCheck(turn)))
+							Board a(this, x, y, x - 1, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
+							Board b(this, x, y, x - 2, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
+							if (!(a.isCheck(turn) || b.isCheck(turn)))
 							{
-								freeBoard(a);
-								freeBoard(b);
 								checkMove(x, y, x - 2, y, black_castling_l, black_castling_r, false, false);
 							}
 						}
@@ -616,12 +1842,10 @@ public:
 						if (white_castling_r && !isCheck(turn) && squares[x + 1][y] == 0 && squares[x + 2][y] == 0)
 						{
 							// Cannot Castle Through Check
-							Board* a = new Board(this, x, y, x + 1, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
-							Board* b = new Board(this, x, y, x + 2, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
-							if (!(a->isCheck(turn) || b->isCheck(turn)))
+							Board a(this, x, y, x + 1, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
+							Board b(this, x, y, x + 2, y, black_castling_l, black_castling_r, true, true, 0, -1, 0);
+							if (!(a.isCheck(turn) || b.isCheck(turn)))
 							{
-								freeBoard(a);
-								freeBoard(b);
 								checkMove(x, y, x + 2, y, black_castling_l, black_castling_r, false, false);
 							}
 						}
@@ -631,15 +1855,47 @@ public:
 			}
 		}
 	}
+	// Pawn move or capture, reaching the last rank it can become any of the four pieces
+	void checkPawnMove(int x, int y, int xi, int yi)
+	{
+		if (yi == 0 || yi == 7)
+		{
+			// Queen (0) first so it is the one tried first and found by the window
+			const int pieces[4] = { 0, 3, 4, 2 };
+			for (int piece : pieces)
+			{
+				checkMove(x, y, xi, yi, black_castling_l, black_castling_r, white_castling_l, white_castling_r, piece);
+			}
+		}
+		else
+		{
+			checkMove(x, y, xi, yi, black_castling_l, black_castling_r, white_castling_l, white_castling_r);
+		}
+	}
 	// Check if a given move results in check or other invalid posiiton
 	void checkMove(int x, int y, int xi, int yi, bool bcl, bool bcr, bool wcl, bool wcr, int piece = 0, int ep = -1)
 	{
-		Move m = Move(x, y, xi, yi, bcl, bcr, wcl, wcr, piece, ep);
-		Board* b = new Board(this, x, y, xi, yi, bcl, bcr, wcl, wcr, piece, ep, 0);
-		if (!b->isCheck(turn))
+		// Capturing a rook on its starting square also takes away castling on that side
+		if (xi == 0 && yi == 0)
+		{
+			bcl = false;
+		}
+		else if (xi == 7 && yi == 0)
+		{
+			bcr = false;
+		}
+		else if (xi == 0 && yi == 7)
+		{
+			wcl = false;
+		}
+		else if (xi == 7 && yi == 7)
+		{
+			wcr = false;
+		}
+		Board b(this, x, y, xi, yi, bcl, bcr, wcl, wcr, piece, ep, 0);
+		if (!b.isCheck(turn))
 		{
-			freeBoard(b);
-			moves->push_back(new Move(x, y, xi, yi, bcl, bcr, wcl, wcr, piece, ep));
+			moves.push_back(Move(x, y, xi, yi, bcl, bcr, wcl, wcr, piece, ep));
 		}
 	}
 	// Checks if a player is in check on this board
@@ -684,7 +1940,7 @@ public:
 				a = ((l % 2) * 2) - 1;
 				b = ((l / 2) * 2) - 1;
 				n = 1;
-				while (x + (n * a) >= 0 && x + (n * a) < 8 && y + (n * b) >= 0 && y + (n * b) < 8 && (squares[x + (n * a)][y + (n * b)] ==  2 || squares[x + (n * a)][y + (n * b)] == 5 || (squares[x + (n * a)][y + (n * b)] == 6 && n == 1) || (squares[x + (n * a)][y + (n * b)] == 1 && n == 1 && a == 1) || squares[x + (n * a)][y + (n * b)] == 0))
+				while (x + (n * a) >= 0 && x + (n * a) < 8 && y + (n * b) >= 0 && y + (n * b) < 8 && (squares[x + (n * a)][y + (n * b)] ==  2 || squares[x + (n * a)][y + (n * b)] == 5 || (squares[x + (n * a)][y + (n * b)] == 6 && n == 1) || (squares[x + (n * a)][y + (n * b)] == 1 && n == 1 && b == -1) || squares[x + (n * a)][y + (n * b)] == 0))
 				{
 					if (squares[x + (n * a)][y + (n * b)] != 0)
 					{
@@ -748,7 +2004,7 @@ public:
 				a = ((l % 2) * 2) - 1;
 				b = ((l / 2) * 2) - 1;
 				n = 1;
-				while (x + (n * a) >= 0 && x + (n * a) < 8 && y + (n * b) >= 0 && y + (n * b) < 8 && (squares[x + (n * a)][y + (n * b)] == 12 || squares[x + (n * a)][y + (n * b)] == 15 || (squares[x + (n * a)][y + (n * b)] == 16 && n == 1) || (squares[x + (n * a)][y + (n * b)] == 11 && n == 1 && a == -1) || squares[x + (n * a)][y + (n * b)] == 0))
+				while (x + (n * a) >= 0 && x + (n * a) < 8 && y + (n * b) >= 0 && y + (n * b) < 8 && (squares[x + (n * a)][y + (n * b)] == 12 || squares[x + (n * a)][y + (n * b)] == 15 || (squares[x + (n * a)][y + (n * b)] == 16 && n == 1) || (squares[x + (n * a)][y + (n * b)] == 11 && n == 1 && b == 1) || squares[x + (n * a)][y + (n * b)] == 0))
 				{
 					if (squares[x + (n * a)][y + (n * b)] != 0)
 					{
@@ -774,154 +2030,3924 @@ public:
 				}
 			}
 		}
-		return false;
+		return false;
+	}
+	// Hashes the pieces, side to move, castling rights and en passant file into one key
+	void computeKey()
+	{
+		int x, y;
+		const unsigned long long* zobrist = zobristKeys();
+		key = 0;
+		for (x = 0; x < 8; x++)
+		{
+			for (y = 0; y < 8; y++)
+			{
+				if (squares[x][y] != 0)
+				{
+					// Piece codes 1-6 and 11-16 map to 12 tables of 64 squares
+					key ^= zobrist[(((squares[x][y] % 10) - 1 + (6 * (squares[x][y] / 10))) * 64) + (8 * x) + y];
+				}
+			}
+		}
+		if (turn)
+		{
+			key ^= zobrist[12 * 64];
+		}
+		if (white_castling_l)
+		{
+			key ^= zobrist[(12 * 64) + 1];
+		}
+		if (white_castling_r)
+		{
+			key ^= zobrist[(12 * 64) + 2];
+		}
+		if (black_castling_l)
+		{
+			key ^= zobrist[(12 * 64) + 3];
+		}
+		if (black_castling_r)
+		{
+			key ^= zobrist[(12 * 64) + 4];
+		}
+		if (en_passant != -1)
+		{
+			key ^= zobrist[(12 * 64) + 5 + en_passant];
+		}
+	}
+	// Checks for a draw by the fifty move rule or by repeating an earlier position
+	// Expects this position to be the last one in key_history
+	bool isDraw()
+	{
+		if (halfmove >= 100)
+		{
+			return true;
+		}
+		// Only positions since the last irreversible move with the same side to move can repeat
+		int n = (int)key_history.size();
+		for (int i = n - 3; i >= 0 && i >= n - 1 - halfmove; i -= 2)
+		{
+			if (key_history[i] == key)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	// Evalutates Given position based on piece counts, and positions
+	void evaluate()
+	{
+		int x, y, e = 0;
+		// Count up given pieces as well as add points based on their piece tables
+		for (x = 0; x < 8; x++)
+		{
+			for (y = 0; y < 8; y++)
+			{
+				switch (squares[x][y])
+				{
+				case 1:
+					e -= engine->pawn;
+					e -= engine->tables[(0 * 64) + (8 * (7 - x)) + y];
+					break;
+				case 2:
+					e -= engine->bishop;
+					e -= engine->tables[(1 * 64) + (8 * (7 - x)) + y];
+					break;
+				case 3:
+					e -= engine->knight;
+					e -= engine->tables[(2 * 64) + (8 * (7 - x)) + y];
+					break;
+				case 4:
+					e -= engine->rook;
+					e -= engine->tables[(3 * 64) + (8 * (7 - x)) + y];
+					break;
+				case 5:
+					e -= engine->queen;
+					e -= engine->tables[(4 * 64) + (8 * (7 - x)) + y];
+					break;
+				case 11:
+					e += engine->pawn;
+					e += engine->tables[(0 * 64) + (8 * x) + y];
+					break;
+				case 12:
+					e += engine->bishop;
+					e += engine->tables[(1 * 64) + (8 * x) + y];
+					break;
+				case 13:
+					e += engine->knight;
+					e += engine->tables[(2 * 64) + (8 * x) + y];
+					break;
+				case 14:
+					e += engine->rook;
+					e += engine->tables[(3 * 64) + (8 * x) + y];
+					break;
+				case 15:
+					e += engine->queen;
+					e += engine->tables[(4 * 64) + (8 * x) + y];
+					break;
+				}
+			}
+		}
+		if (!turn)
+		{
+			e = e * -1;
+		}
+		eval = e;
+	}
+	// Value of the piece a move takes, 0 if it is a quiet move
+	int captureValue(Move* m)
+	{
+		if (squares[m->to_x][m->to_y] != 0)
+		{
+			return pieceValue(squares[m->to_x][m->to_y]);
+		}
+		if (squares[m->from_x][m->from_y] % 10 == 1 && m->from_x != m->to_x) // en passant
+		{
+			return engine->pawn;
+		}
+		return 0;
+	}
+	// Finds the least valuable piece of the given color attacking a square on a scratch board
+	bool leastAttacker(int sq[8][8], int tx, int ty, bool color, int& ax, int& ay)
+	{
+		int a, b, n, l, p;
+		int best = -1;
+		int own = color ? 10 : 0;
+		// Pawns
+		for (a = -1; a <= 1; a += 2)
+		{
+			b = color ? 1 : -1; // white pawns attack upwards, so they sit below the square
+			if (tx + a >= 0 && tx + a < 8 && ty + b >= 0 && ty + b < 8 && sq[tx + a][ty + b] == own + 1)
+			{
+				ax = tx + a;
+				ay = ty + b;
+				return true;
+			}
+		}
+		// Knights
+		for (n = 0; n < 8; n++)
+		{
+			a = (n % 4) + ((n % 4) / 2) - 2;
+			b = (((n % 4) + ((n % 4) / 2)) % 2 + 1) * (((n / 4) * 2) - 1);
+			if (tx + a >= 0 && tx + a < 8 && ty + b >= 0 && ty + b < 8 && sq[tx + a][ty + b] == own + 3)
+			{
+				ax = tx + a;
+				ay = ty + b;
+				return true;
+			}
+		}
+		// Sliding pieces and king, first piece found along each of the 8 rays
+		for (l = 0; l < 8; l++)
+		{
+			if (l < 4)
+			{
+				a = ((l % 2) * 2) - 1;
+				b = ((l / 2) * 2) - 1;
+			}
+			else
+			{
+				a = (1 - ((l - 4) / 2)) * ((((l - 4) % 2) * 2) - 1);
+				b = ((l - 4) / 2) * ((((l - 4) % 2) * 2) - 1);
+			}
+			n = 1;
+			while (tx + (n * a) >= 0 && tx + (n * a) < 8 && ty + (n * b) >= 0 && ty + (n * b) < 8 && sq[tx + (n * a)][ty + (n * b)] == 0)
+			{
+				n++;
+			}
+			if (tx + (n * a) < 0 || tx + (n * a) >= 8 || ty + (n * b) < 0 || ty + (n * b) >= 8)
+			{
+				continue;
+			}
+			p = sq[tx + (n * a)][ty + (n * b)];
+			if (p / 10 != own / 10 || (p == own + 6 && n != 1))
+			{
+				continue;
+			}
+			// Bishops only on diagonals, rooks only on laterals
+			if ((p % 10 == 2 && l >= 4) || (p % 10 == 4 && l < 4) || p % 10 == 1 || p % 10 == 3)
+			{
+				continue;
+			}
+			if (best == -1 || pieceValue(p) < pieceValue(sq[ax][ay]))
+			{
+				best = p;
+				ax = tx + (n * a);
+				ay = ty + (n * b);
+			}
+		}
+		return best != -1;
+	}
+	// Static exchange evaluation, material won or lost by playing out all captures on the target square
+	int see(Move* m)
+	{
+		int sq[8][8];
+		int gain[32];
+		int x, y, d = 0;
+		int attacker_value, ax = 0, ay = 0;
+		bool side = !turn;
+		for (x = 0; x < 8; x++)
+		{
+			for (y = 0; y < 8; y++)
+			{
+				sq[x][y] = squares[x][y];
+			}
+		}
+		gain[0] = captureValue(m);
+		if (sq[m->to_x][m->to_y] == 0 && sq[m->from_x][m->from_y] % 10 == 1 && m->from_x != m->to_x)
+		{
+			sq[m->to_x][m->from_y] = 0; // en passant
+		}
+		attacker_value = pieceValue(sq[m->from_x][m->from_y]);
+		sq[m->to_x][m->to_y] = sq[m->from_x][m->from_y];
+		sq[m->from_x][m->from_y] = 0;
+		// Each side keeps recapturing with its least valuable piece
+		while (d < 31 && leastAttacker(sq, m->to_x, m->to_y, side, ax, ay))
+		{
+			d++;
+			gain[d] = attacker_value - gain[d - 1];
+			attacker_value = pieceValue(sq[ax][ay]);
+			sq[m->to_x][m->to_y] = sq[ax][ay];
+			sq[ax][ay] = 0;
+			side = !side;
+		}
+		// Either side may stop capturing when continuing loses material
+		while (d > 0)
+		{
+			gain[d - 1] = -max(-gain[d - 1], gain[d]);
+			d--;
+		}
+		return gain[0];
+	}
+	// Searches only captures (or every evasion when in check) until the position is quiet,
+	// so leaves are not evaluated in the middle of a trade
+	int quiesce(int alpha, int beta)
+	{
+		counters.qnodes++;
+		checkTime();
+		if (engine->stop)
+		{
+			return eval;
+		}
+		bool in_check = isCheck(turn);
+		if (moves.empty())
+		{
+			return in_check ? -10000000 : 0;
+		}
+		int best = -10000000;
+		if (!in_check)
+		{
+			// Stand pat, the side to move does not have to capture
+			if (eval >= beta)
+			{
+				return eval;
+			}
+			if (eval > alpha)
+			{
+				alpha = eval;
+			}
+			best = eval;
+		}
+		// Collect captures worth searching, most valuable victim / least valuable attacker first.
+		// Kept as (order, index into moves) on the stack, sorted by insertion so nothing is allocated
+		pair<int, int> captures[MAX_MOVES];
+		int num_captures = 0;
+		for (MoveList::iterator i = moves.begin(); i != moves.end(); i++)
+		{
+			int victim = captureValue(&*i);
+			if (!in_check)
+			{
+				if (victim == 0)
+				{
+					continue;
+				}
+				// Delta pruning, even winning this piece cannot bring the score up to alpha
+				if (eval + victim + engine->delta_margin <= alpha)
+				{
+					continue;
+				}
+				// Skip captures that lose material
+				if (see(&*i) < 0)
+				{
+					continue;
+				}
+			}
+			pair<int, int> c(victim * 10 - pieceValue(squares[i->from_x][i->from_y]) / 100, (int)(i - moves.begin()));
+			int j = num_captures++;
+			for (; j > 0 && captures[j - 1].first < c.first; j--)
+			{
+				captures[j] = captures[j - 1];
+			}
+			captures[j] = c;
+		}
+		for (int c = 0; c < num_captures; c++)
+		{
+			Move* m = moves.begin() + captures[c].second;
+			Board* b = new Board(this, m->from_x, m->from_y, m->to_x, m->to_y, m->black_castling_l, m->black_castling_r, m->white_castling_l, m->white_castling_r, m->promotion_piece, m->en_passant);
+			int score = -b->quiesce(-beta, -alpha);
+			delete b;
+			if (score > best)
+			{
+				best = score;
+				if (score >= beta)
+				{
+					return score;
+				}
+				if (score > alpha)
+				{
+					alpha = score;
+				}
+			}
+		}
+		return best;
+	}
+	// Main function for finding best moves
+	// Recursively searches d moves ahead using negamax (minmax from the side to move's view)
+	// Also uses alpha beta pruning to avoid unnecessary calculations
+	// NT is the kind of node, so root and PV only work is compiled out of the non-PV nodes
+	// that make up most of the tree. The root returns the board after the best move,
+	// every other node returns itself with eval set to its score
+	template <NodeType NT>
+	Board* getBest(int d, int alpha, int beta)
+	{
+		const bool root_node = NT == ROOT;
+		const bool pv_node = NT != NON_PV;
+		Board* best_board = NULL;
+		Move* best_move = NULL;
+		int score;
+		int alpha_orig = alpha;
+		bool first = true;
+		STAT(int searched = 0);
+		counters.nodes++;
+		checkTime();
+		if (!root_node && engine->stop)
+		{
+			return this;
+		}
+		if (root_node)
+		{
+			ply = 0;
+		}
+		if (pv_node)
+		{
+			pv_length[ply] = ply;
+		}
+		// A repeated position or fifty moves without progress is a draw, nothing left to search
+		if (!root_node && isDraw())
+		{
+			eval = 0;
+			return this;
+		}
+		if (d == 0)
+		{
+			eval = quiesce(alpha, beta);
+			return this;
+		}
+		int static_eval = eval;
+		bool in_check = isCheck(turn);
+		if (moves.empty())
+		{
+			eval = in_check ? -10000000 : 0;
+			return this;
+		}
+		// Transposition table, cut off on a deep enough result and try its best move first
+		int tt_score, tt_depth, tt_bound, tt_move;
+		STAT(counters.tt_probes++);
+		if (engine->tt.probe(key, tt_score, tt_depth, tt_bound, tt_move))
+		{
+			STAT(counters.tt_hits++);
+			if (!pv_node && tt_depth >= d && (tt_bound == TT_EXACT || (tt_bound == TT_LOWER && tt_score >= beta) || (tt_bound == TT_UPPER && tt_score <= alpha)))
+			{
+				STAT(counters.tt_cutoffs++);
+				eval = tt_score;
+				return this;
+			}
+			if (tt_move != 0)
+			{
+				for (MoveList::iterator i = moves.begin(); i != moves.end(); i++)
+				{
+					if (i->from_x == (tt_move & 7) && i->from_y == ((tt_move >> 3) & 7) && i->to_x == ((tt_move >> 6) & 7) && i->to_y == ((tt_move >> 9) & 7))
+					{
+						moves.moveToFront(i);
+						break;
+					}
+				}
+			}
+		}
+		// Margin based pruning close to the leaves, only in zero window nodes
+		bool futile = false;
+		if (!pv_node && !in_check && d < 4)
+		{
+			// Reverse futility, static eval is so far above beta a quiet move will not bring it back down
+			if (static_eval - engine->reverse_futility_margin[d] >= beta)
+			{
+				STAT(counters.reverse_futility_pruned++);
+				eval = static_eval - engine->reverse_futility_margin[d];
+				return this;
+			}
+			// Razoring, hopelessly below alpha so only captures can save the position
+			if (static_eval + engine->razor_margin[d] <= alpha)
+			{
+				int q = quiesce(alpha, beta);
+				if (q <= alpha)
+				{
+					STAT(counters.razored++);
+					eval = q;
+					return this;
+				}
+			}
+			// Futility, quiet moves will not be searched unless they give check
+			futile = static_eval + engine->futility_margin[d] <= alpha;
+		}
+		eval = -10000000;
+		for (MoveList::iterator i = moves.begin(); i != moves.end(); i++)
+		{
+			if (futile && !first && captureValue(&*i) == 0 && !(squares[i->from_x][i->from_y] % 10 == 1 && (i->to_y == 0 || i->to_y == 7)))
+			{
+				// Checks are cheap to test on a board without moves generated. Pooled rather than
+				// on the stack, a move list is too big to keep one in every frame of the search
+				unique_ptr<Board> quiet(new Board(this, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant, 0));
+				if (!quiet->isCheck(quiet->turn))
+				{
+					STAT(counters.futility_pruned++);
+					continue;
+				}
+			}
+			long long move_start = root_node ? tracer.begin() : -1;
+			bool full_window = false; // Whether the child was searched as a PV node, with its line filled in
+			if (pv_node)
+			{
+				pv_length[ply + 1] = ply + 1; // No line from the child until it has searched one
+			}
+			unique_ptr<Board> b(new Board(this, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant));
+			ALLOC(HotPath hot(true));
+			key_history.push_back(b->key);
+			// Principal variation search, the first move gets the full window and
+			// the rest only have to show they are no better than it
+			if (!pv_node)
+			{
+				score = -b->getBest<NON_PV>(d - 1, -beta, -alpha)->eval;
+			}
+			else if (first)
+			{
+				score = -b->getBest<PV>(d - 1, -beta, -alpha)->eval;
+				full_window = true;
+			}
+			else
+			{
+				score = -b->getBest<NON_PV>(d - 1, -alpha - 1, -alpha)->eval;
+				if (score > alpha && score < beta)
+				{
+					b->evaluate(); // eval was overwritten by the first search
+					score = -b->getBest<PV>(d - 1, -beta, -alpha)->eval;
+					full_window = true;
+				}
+			}
+			key_history.pop_back();
+			if (move_start >= 0)
+			{
+				tracer.end("root move", move_start, score, moveName(&*i));
+			}
+			// Out of time, the score is not finished. The root still needs some move to return
+			if (engine->stop && !(root_node && best_board == NULL))
+			{
+				break;
+			}
+			first = false;
+			STAT(searched++);
+			if (score > eval || (root_node && best_board == NULL))
+			{
+				eval = score;
+				best_move = &*i;
+				// The root keeps the board of its best move to return it
+				if (root_node)
+				{
+					delete best_board;
+					best_board = b.release();
+				}
+				if (score > alpha)
+				{
+					alpha = score;
+					if (pv_node)
+					{
+						// This move followed by the child's line is the new principal variation. A
+						// child that only failed high on the zero window has no line to add
+						pv_table[ply][ply] = *i;
+						pv_length[ply] = ply + 1;
+						if (full_window)
+						{
+							for (int p = ply + 1; p < pv_length[ply + 1]; p++)
+							{
+								pv_table[ply][p] = pv_table[ply + 1][p];
+							}
+							pv_length[ply] = max(pv_length[ply + 1], ply + 1);
+						}
+					}
+				}
+			}
+			// Beta cutoff, the opponent will not allow this position
+			if (eval >= beta)
+			{
+				STAT(counters.fail_highs++);
+				STAT(counters.first_move_fail_highs += searched == 1);
+				break;
+			}
+		}
+		if (!engine->stop)
+		{
+			engine->tt.store(key, eval, d, eval <= alpha_orig ? TT_UPPER : (eval >= beta ? TT_LOWER : TT_EXACT), best_move);
+		}
+		return root_node ? best_board : this;
+	}
+};
+
+// Helper thread for think, runs its own iterative deepening on a copy of the root
+// Odd helpers search one ply deeper so the threads spread over different depths
+void helperSearch(Engine* e, Board* root, int id, vector<unsigned long long> history)
+{
+	EngineScope scope(e);
+	main_thread = false;
+	trace_thread_name = "helper";
+	pinThread(id);
+	key_history = history;
+	counters.clear();
+	key_history.reserve(key_history.size() + MAX_PLY);
+	board_pool.reserve(sizeof(Board), 2 * MAX_PLY);
+	for (int d = 1 + (id % 2); d < MAX_DEPTH && !engine->stop; d++)
+	{
+		TraceSpan span("helper iteration", d);
+		Board* result = root->getBest<ROOT>(d, -100000, 100000);
+		if (result != NULL && result != root)
+		{
+			delete result;
+		}
+	}
+	engine->addCounters();
+	delete root;
+}
+
+Board* ybwcThink(Board* root);
+Board* mctsThink(Board* root);
+
+Board* lazySMPThink(Board* root);
+
+// The move from root to the board think returned. The principal variation can be empty,
+// when every move is lost, so the board is matched against each move instead. Falls back to
+// the first move of the line, then to the first legal move
+Move thinkMove(Board* root, Board* result)
+{
+	if (result != NULL && result != root)
+	{
+		for (auto& m : root->moves)
+		{
+			Board child(root, m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant, 0);
+			if (memcmp(child.squares, result->squares, sizeof(child.squares)) == 0)
+			{
+				return m;
+			}
+		}
+	}
+	if (!engine->search_line.empty())
+	{
+		return engine->search_line[0];
+	}
+	return root->moves.empty() ? Move() : *root->moves.begin();
+}
+
+// Searches the position with the engine's threads sharing the transposition table
+// The calling thread owns the clock and picks the move, returns the board after it
+// Afterwards the engine's totals hold the counters of every thread in the search
+Board* think(Board* root)
+{
+	TraceSpan span("think", engine->depth);
+	counters.clear();
+	// Room for the search path and the boards along it, so the search below the root
+	// does not allocate
+	key_history.reserve(key_history.size() + MAX_PLY);
+	board_pool.reserve(sizeof(Board), 2 * MAX_PLY);
+	engine->totals.clear();
+	STAT(engine->depth_nodes.clear());
+	STAT(engine->depth_ms.clear());
+	Board* result;
+	if (engine->backend == YBWC)
+	{
+		result = ybwcThink(root);
+	}
+	else if (engine->backend == MCTS)
+	{
+		result = mctsThink(root);
+	}
+	else
+	{
+		result = lazySMPThink(root);
+	}
+	engine->addCounters();
+	engine->search_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - engine->search_start).count();
+	return result;
+}
+
+// think for the Lazy SMP backend, helpers run their own iterative deepening on copies
+// of the root and share results through the transposition table
+Board* lazySMPThink(Board* root)
+{
+	Board* best = NULL;
+	if (engine->tt.entries == NULL)
+	{
+		engine->tt.resize(engine->hash_mb);
+	}
+	engine->stop = false;
+	engine->search_start = chrono::steady_clock::now();
+	pinThread(0);
+	vector<thread> helpers;
+	for (int i = 1; i < engine->threads; i++)
+	{
+		helpers.push_back(thread(helperSearch, engine, new Board(root), i, key_history));
+	}
+	// Iterative deepening, each iteration fills the table for the next
+	for (int d = 1; d <= min(engine->depth, MAX_DEPTH); d++)
+	{
+		TraceSpan span("iteration", d);
+		Board* result = root->getBest<ROOT>(d, -100000, 100000);
+		if (engine->stop && best != NULL)
+		{
+			// Unfinished iteration, keep the last complete one
+			tracer.instant("iteration abandoned", d);
+			if (result != NULL && result != root)
+			{
+				delete result;
+			}
+			break;
+		}
+		if (best != NULL)
+		{
+			delete best;
+		}
+		best = result;
+		engine->search_eval = root->eval;
+		engine->search_line.assign(pv_table[0], pv_table[0] + pv_length[0]);
+		STAT(engine->depth_nodes.push_back(counters.total()));
+		STAT(engine->depth_ms.push_back(chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - engine->search_start).count()));
+		if (engine->stop)
+		{
+			break;
+		}
+	}
+	engine->stop = true;
+	long long join_start = tracer.begin();
+	for (auto& h : helpers)
+	{
+		h.join();
+	}
+	tracer.end("join helpers", join_start);
+	root->eval = engine->search_eval;
+	return best;
+}
+
+// Double ended queue of tasks, the owning thread works from the back and
+// idle threads steal from the front
+template <class T>
+class WorkStealingDeque {
+public:
+	mutex lock;
+	deque<T> tasks;
+
+	void push(const T& t)
+	{
+		lock_guard<mutex> guard(lock);
+		tasks.push_back(t);
+	}
+	bool pop(T& t)
+	{
+		lock_guard<mutex> guard(lock);
+		if (tasks.empty())
+		{
+			return false;
+		}
+		t = tasks.back();
+		tasks.pop_back();
+		return true;
+	}
+	bool steal(T& t)
+	{
+		lock_guard<mutex> guard(lock);
+		if (tasks.empty())
+		{
+			return false;
+		}
+		t = tasks.front();
+		tasks.pop_front();
+		return true;
+	}
+};
+
+// Node whose younger brothers are being searched in parallel
+// Lives on the stack of the thread that split, which waits for every task to finish
+struct SplitPoint
+{
+	Board* board; // Read only while split
+	SplitPoint* parent;
+	vector<unsigned long long> history; // key_history up to and including board
+	int depth;
+	int beta;
+	atomic<int> alpha;
+	atomic<int> pending; // Tasks not finished yet
+	atomic<bool> cancelled;
+	mutex lock; // Guards best and best_move
+	int best;
+	Move best_move;
+
+	// A cutoff anywhere above makes this node's result worthless as well
+	bool isCancelled()
+	{
+		for (SplitPoint* sp = this; sp != NULL; sp = sp->parent)
+		{
+			if (sp->cancelled)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+struct SplitTask
+{
+	SplitPoint* sp;
+	Move move;
+};
+
+// Young Brothers Wait search
+// The eldest child of a node is searched first by one thread, after that its younger
+// brothers become tasks in the thread's deque that other threads can steal.
+// A beta cutoff cancels every outstanding task of the node
+class YBWCSearch {
+public:
+	vector<unique_ptr<WorkStealingDeque<SplitTask>>> deques;
+	vector<thread> workers;
+	atomic<bool> done;
+
+	YBWCSearch(int threads)
+	{
+		done = false;
+		for (int i = 0; i < threads; i++)
+		{
+			deques.push_back(unique_ptr<WorkStealingDeque<SplitTask>>(new WorkStealingDeque<SplitTask>()));
+		}
+		for (int i = 1; i < threads; i++)
+		{
+			workers.push_back(thread(&YBWCSearch::workerLoop, this, engine, i));
+		}
+	}
+	~YBWCSearch()
+	{
+		done = true;
+		for (auto& w : workers)
+		{
+			w.join();
+		}
+	}
+	void workerLoop(Engine* e, int id)
+	{
+		EngineScope scope(e);
+		main_thread = false;
+		pinThread(id);
+		ybwc_id = id;
+		trace_thread_name = "ybwc worker";
+		counters.clear();
+		while (!done)
+		{
+			if (!runOneTask())
+			{
+				this_thread::yield();
+			}
+		}
+		engine->addCounters();
+	}
+	// Runs a task from this thread's deque, or steals one from another thread
+	bool runOneTask()
+	{
+		SplitTask t;
+		if (!deques[ybwc_id]->pop(t))
+		{
+			bool found = false;
+			for (size_t i = 1; i < deques.size() && !found; i++)
+			{
+				found = deques[(ybwc_id + i) % deques.size()]->steal(t);
+			}
+			if (!found)
+			{
+				return false;
+			}
+		}
+		SplitPoint* sp = t.sp;
+		if (!sp->isCancelled() && !engine->stop)
+		{
+			TraceSpan span("split move", sp->depth);
+			vector<unsigned long long> saved = key_history;
+			key_history = sp->history;
+			Board* child = new Board(sp->board, t.move.from_x, t.move.from_y, t.move.to_x, t.move.to_y, t.move.black_castling_l, t.move.black_castling_r, t.move.white_castling_l, t.move.white_castling_r, t.move.promotion_piece, t.move.en_passant);
+			key_history.push_back(child->key);
+			int a = sp->alpha;
+			if (a < sp->beta)
+			{
+				// Zero window first, a full window only if the move beats the best so far
+				int score = -node(child, sp->depth - 1, -a - 1, -a, sp, NULL);
+				if (score > a && score < sp->beta && !sp->isCancelled())
+				{
+					child->evaluate();
+					score = -node(child, sp->depth - 1, -sp->beta, -a, sp, NULL);
+				}
+				if (!sp->isCancelled() && !engine->stop)
+				{
+					lock_guard<mutex> guard(sp->lock);
+					if (score > sp->best)
+					{
+						sp->best = score;
+						sp->best_move = t.move;
+						if (score > sp->alpha)
+						{
+							sp->alpha = score;
+						}
+						if (score >= sp->beta)
+						{
+							sp->cancelled = true;
+						}
+					}
+				}
+			}
+			delete child;
+			key_history = saved;
+		}
+		sp->pending--;
+		return true;
+	}
+	// Searches b, which must be last in key_history, and returns its score
+	// The root passes best_out to get its best move back
+	int node(Board* b, int d, int alpha, int beta, SplitPoint* parent, Move* best_out)
+	{
+		bool root_node = best_out != NULL;
+		counters.nodes++;
+		checkTime();
+		if (engine->stop || (parent != NULL && parent->isCancelled()))
+		{
+			return 0;
+		}
+		if (!root_node && b->isDraw())
+		{
+			return 0;
+		}
+		// Small subtrees are not worth splitting
+		if (d < engine->ybwc_min_split_depth && !root_node)
+		{
+			counters.nodes--; // Counted again by getBest
+			if (beta - alpha == 1)
+			{
+				b->getBest<NON_PV>(d, alpha, beta);
+			}
+			else
+			{
+				b->getBest<PV>(d, alpha, beta);
+			}
+			return b->eval;
+		}
+		if (b->moves.empty())
+		{
+			return b->isCheck(b->turn) ? -10000000 : 0;
+		}
+		int alpha_orig = alpha;
+		int tt_score, tt_depth, tt_bound, tt_move;
+		if (engine->tt.probe(b->key, tt_score, tt_depth, tt_bound, tt_move))
+		{
+			if (!root_node && beta - alpha == 1 && tt_depth >= d && (tt_bound == TT_EXACT || (tt_bound == TT_LOWER && tt_score >= beta) || (tt_bound == TT_UPPER && tt_score <= alpha)))
+			{
+				return tt_score;
+			}
+			for (MoveList::iterator i = b->moves.begin(); i != b->moves.end() && tt_move != 0; i++)
+			{
+				if (i->from_x == (tt_move & 7) && i->from_y == ((tt_move >> 3) & 7) && i->to_x == ((tt_move >> 6) & 7) && i->to_y == ((tt_move >> 9) & 7))
+				{
+					b->moves.moveToFront(i);
+					break;
+				}
+			}
+		}
+		// Eldest brother, searched alone so the window is known before splitting
+		MoveList::iterator i = b->moves.begin();
+		Move best_move = *i;
+		Board* child = new Board(b, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant);
+		key_history.push_back(child->key);
+		int best = -node(child, d - 1, -beta, -alpha, parent, NULL);
+		key_history.pop_back();
+		delete child;
+		if (best > alpha)
+		{
+			alpha = best;
+		}
+		// Younger brothers
+		if (best < beta && b->moves.size() > 1 && !engine->stop && !(parent != NULL && parent->isCancelled()))
+		{
+			SplitPoint sp;
+			sp.board = b;
+			sp.parent = parent;
+			sp.history = key_history;
+			sp.depth = d;
+			sp.beta = beta;
+			sp.alpha = alpha;
+			sp.best = best;
+			sp.best_move = best_move;
+			sp.cancelled = false;
+			sp.pending = (int)b->moves.size() - 1;
+			for (i++; i != b->moves.end(); i++)
+			{
+				SplitTask t;
+				t.sp = &sp;
+				t.move = *i;
+				deques[ybwc_id]->push(t);
+			}
+			// Help with any work until every brother is done
+			while (sp.pending > 0)
+			{
+				if (!runOneTask())
+				{
+					this_thread::yield();
+				}
+			}
+			best = sp.best;
+			best_move = sp.best_move;
+		}
+		if (!engine->stop && !(parent != NULL && parent->isCancelled()))
+		{
+			Move* m = NULL;
+			for (auto& mv : b->moves)
+			{
+				if (mv.from_x == best_move.from_x && mv.from_y == best_move.from_y && mv.to_x == best_move.to_x && mv.to_y == best_move.to_y)
+				{
+					m = &mv;
+				}
+			}
+			engine->tt.store(b->key, best, d, best <= alpha_orig ? TT_UPPER : (best >= beta ? TT_LOWER : TT_EXACT), m);
+		}
+		if (root_node)
+		{
+			*best_out = best_move;
+		}
+		return best;
+	}
+};
+
+// think for the YBWC backend, iterative deepening with every thread splitting the tree
+Board* ybwcThink(Board* root)
+{
+	Move best_move;
+	bool found = false;
+	if (engine->tt.entries == NULL)
+	{
+		engine->tt.resize(engine->hash_mb);
+	}
+	engine->stop = false;
+	engine->search_start = chrono::steady_clock::now();
+	ybwc_id = 0;
+	pinThread(0);
+	{
+		YBWCSearch pool(max(1, engine->threads));
+		for (int d = 1; d <= min(engine->depth, MAX_DEPTH); d++)
+		{
+			TraceSpan span("iteration", d);
+			Move m;
+			int score = pool.node(root, d, -100000, 100000, NULL, &m);
+			if (engine->stop && found)
+			{
+				break;
+			}
+			best_move = m;
+			found = true;
+			engine->search_eval = score;
+			if (engine->stop)
+			{
+				break;
+			}
+		}
+		engine->stop = true;
+	}
+	engine->search_line.assign(1, best_move);
+	root->eval = engine->search_eval;
+	if (root->moves.empty())
+	{
+		return root;
+	}
+	return root->doMove(best_move.from_x, best_move.from_y, best_move.to_x, best_move.to_y, best_move.promotion_piece);
+}
+
+// Node of the Monte-Carlo search tree
+// Results are stored for the side that played the move into the node
+struct MCTSNode
+{
+	Move move;
+	unsigned long long key;
+	float prior;
+	int first_child; // Children are next to each other in the pool
+	int num_children;
+	atomic<int> state; // 0 leaf, 1 being expanded by a thread, 2 expanded
+	atomic<int> visits;
+	atomic<int> virtual_loss; // Threads currently passing through, counted as losses
+	atomic<long long> value_sum; // Fixed point, MCTS_SCALE per win
+};
+const int MCTS_SCALE = 10000;
+
+// PUCT tree search, threads share one tree and descend it in parallel
+// Nodes come from a fixed pool handed out with an atomic counter, so no locks are needed
+// Leaves are scored with a quiescence search instead of random playouts
+class MCTSSearch {
+public:
+	MCTSNode* pool;
+	int size;
+	atomic<int> used;
+	atomic<int> playouts;
+	int root;
+
+	MCTSSearch(int nodes)
+	{
+		bool huge;
+		pool = (MCTSNode*)allocLarge(sizeof(MCTSNode) * nodes, huge, MEM_TREE);
+		size = nodes;
+		used = 0;
+		playouts = 0;
+		root = -1;
+	}
+	~MCTSSearch()
+	{
+		freeLarge(pool, sizeof(MCTSNode) * size, MEM_TREE);
+	}
+	// Claims n nodes next to each other, -1 if the pool is full
+	int allocate(int n)
+	{
+		int first = used.fetch_add(n);
+		return first + n <= size ? first : -1;
+	}
+	void initNode(int i, Move* m, unsigned long long key, float prior)
+	{
+		MCTSNode& n = *new (&pool[i]) MCTSNode();
+		n.move = m != NULL ? *m : Move();
+		n.key = key;
+		n.prior = prior;
+		n.first_child = 0;
+		n.num_children = 0;
+		n.state = 0;
+		n.visits = 0;
+		n.virtual_loss = 0;
+		n.value_sum = 0;
+	}
+	void reset(unsigned long long key)
+	{
+		tracer.instant("tree reset", used);
+		used = 0;
+		root = allocate(1);
+		initNode(root, NULL, key, 1);
+	}
+	// Moves the root to the position with this key if it is already in the tree, reusing its subtree
+	bool reroot(unsigned long long key)
+	{
+		if (root < 0)
+		{
+			return false;
+		}
+		if (pool[root].key == key)
+		{
+			return true;
+		}
+		MCTSNode& r = pool[root];
+		for (int c = r.first_child; r.state == 2 && c < r.first_child + r.num_children; c++)
+		{
+			if (pool[c].key == key)
+			{
+				root = c;
+				return true;
+			}
+			for (int g = pool[c].first_child; pool[c].state == 2 && g < pool[c].first_child + pool[c].num_children; g++)
+			{
+				if (pool[g].key == key)
+				{
+					root = g;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+	// Average result of a node for the side that moved into it, in -1 to 1
+	double value(MCTSNode& n)
+	{
+		int v = n.visits + n.virtual_loss;
+		return v > 0 ? ((double)n.value_sum / MCTS_SCALE - n.virtual_loss) / v : 0;
+	}
+	// One descent: select down to a leaf, expand it, score it and back the score up
+	void playout(Board* root_board)
+	{
+		int path[MAX_PLY * 4];
+		int len = 0;
+		int n = root;
+		size_t history = key_history.size();
+		double result;
+		Board* b = new Board(root_board);
+		counters.nodes++;
+		path[len++] = n;
+		while (pool[n].state.load(memory_order_acquire) == 2 && pool[n].num_children > 0 && len < MAX_PLY * 4)
+		{
+			MCTSNode& node = pool[n];
+			int best = node.first_child;
+			double best_score = -1e9;
+			double sqrt_visits = sqrt((double)max(1, node.visits + node.virtual_loss));
+			for (int c = node.first_child; c < node.first_child + node.num_children; c++)
+			{
+				double score = value(pool[c]) + engine->mcts_cpuct * pool[c].prior * sqrt_visits / (1 + pool[c].visits + pool[c].virtual_loss);
+				if (score > best_score)
+				{
+					best_score = score;
+					best = c;
+				}
+			}
+			pool[best].virtual_loss++;
+			Move& m = pool[best].move;
+			Board* next = new Board(b, m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant);
+			delete b;
+			b = next;
+			key_history.push_back(b->key);
+			n = best;
+			path[len++] = n;
+		}
+		// Result is from the view of the side to move at the leaf
+		if (b->moves.empty())
+		{
+			result = b->isCheck(b->turn) ? -1 : 0;
+		}
+		else if (len > 1 && b->isDraw())
+		{
+			result = 0;
+		}
+		else
+		{
+			int expected = 0;
+			if (pool[n].state.compare_exchange_strong(expected, 1))
+			{
+				expand(n, b);
+			}
+			result = tanh(b->quiesce(-100000, 100000) / 400.0);
+		}
+		for (int k = len - 1; k >= 0; k--)
+		{
+			result = -result;
+			pool[path[k]].value_sum += (long long)(result * MCTS_SCALE);
+			pool[path[k]].visits++;
+			if (k > 0)
+			{
+				pool[path[k]].virtual_loss--;
+			}
+		}
+		key_history.resize(history);
+		delete b;
+	}
+	// Adds a child for every legal move, priors come from a softmax over the children's static evals
+	void expand(int n, Board* b)
+	{
+		int first = allocate((int)b->moves.size());
+		if (first < 0)
+		{
+			pool[n].state = 0; // Pool is full, the node stays a leaf
+			return;
+		}
+		vector<double> weights;
+		vector<unsigned long long> keys;
+		double total = 0;
+		for (auto& m : b->moves)
+		{
+			Board c(b, m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant);
+			weights.push_back(exp(max(-20.0, min(20.0, -(c.eval + b->eval) / 200.0))));
+			keys.push_back(c.key);
+			total += weights.back();
+		}
+		int c = 0;
+		for (auto& m : b->moves)
+		{
+			initNode(first + c, &m, keys[c], (float)(weights[c] / total));
+			c++;
+		}
+		pool[n].first_child = first;
+		pool[n].num_children = c;
+		pool[n].state.store(2, memory_order_release);
+	}
+	// Child of a node with the most visits
+	int mostVisited(int n)
+	{
+		int best = -1;
+		for (int c = pool[n].first_child; pool[n].state == 2 && c < pool[n].first_child + pool[n].num_children; c++)
+		{
+			if (best == -1 || pool[c].visits > pool[best].visits)
+			{
+				best = c;
+			}
+		}
+		return best;
+	}
+};
+
+void mctsWorker(Engine* e, Board* root, vector<unsigned long long> history, int budget, int id)
+{
+	EngineScope scope(e);
+	main_thread = false;
+	pinThread(id);
+	key_history = history;
+	trace_thread_name = "mcts worker";
+	counters.clear();
+	TraceSpan span("playouts");
+	while (!engine->stop && engine->mcts->playouts++ < budget)
+	{
+		engine->mcts->playout(root);
+	}
+	engine->addCounters();
+}
+
+// think for the MCTS backend, the engine's threads descend the shared tree until the
+// playout or time budget is used, then the most visited move is played
+Board* mctsThink(Board* root)
+{
+	if (root->moves.empty())
+	{
+		return root;
+	}
+	if (engine->mcts == NULL)
+	{
+		engine->mcts = new MCTSSearch(engine->mcts_pool_size);
+	}
+	// Keep the tree from the last move when this position is in it and there is room left
+	if (!engine->mcts->reroot(root->key) || engine->mcts->used > engine->mcts->size - engine->mcts->size / 8)
+	{
+		engine->mcts->reset(root->key);
+	}
+	engine->stop = false;
+	engine->search_start = chrono::steady_clock::now();
+	engine->mcts->playouts = 0;
+	int budget = engine->time_ms > 0 ? INT32_MAX : engine->mcts_playouts;
+	pinThread(0);
+	vector<thread> helpers;
+	for (int i = 1; i < engine->threads; i++)
+	{
+		helpers.push_back(thread(mctsWorker, engine, root, key_history, budget, i));
+	}
+	long long playout_start = tracer.begin();
+	while (!engine->stop && engine->mcts->playouts++ < budget)
+	{
+		engine->mcts->playout(root);
+		checkTime();
+	}
+	tracer.end("playouts", playout_start);
+	engine->stop = true;
+	for (auto& h : helpers)
+	{
+		h.join();
+	}
+	// Line of most visited moves
+	engine->search_line.clear();
+	for (int n = engine->mcts->mostVisited(engine->mcts->root); n != -1 && engine->search_line.size() < MAX_PLY; n = engine->mcts->mostVisited(n))
+	{
+		engine->search_line.push_back(engine->mcts->pool[n].move);
+	}
+	int best = engine->mcts->mostVisited(engine->mcts->root);
+	double q = max(-0.999, min(0.999, engine->mcts->value(engine->mcts->pool[best])));
+	engine->search_eval = (int)(400 * atanh(q));
+	root->eval = engine->search_eval;
+	engine->mcts->root = best;
+	Move& m = engine->mcts->pool[best].move;
+	return root->doMove(m.from_x, m.from_y, m.to_x, m.to_y, m.promotion_piece);
+}
+
+Engine::Engine()
+{
+	depth = 4;
+	time_ms = 0;
+	node_limit = 0;
+	threads = 1;
+	hash_mb = 64;
+	pin_threads = false;
+	numa_interleave = false;
+	large_pages = true;
+	backend = LAZY_SMP;
+	ybwc_min_split_depth = 2;
+	mcts_playouts = 2000;
+	mcts_pool_size = 1 << 19;
+	mcts_cpuct = 1.5;
+	delta_margin = 200;
+	const int futility[4] = { 0, 200, 300, 500 };
+	const int reverse_futility[4] = { 0, 150, 300, 450 };
+	const int razor[4] = { 0, 300, 500, 700 };
+	for (int d = 0; d < 4; d++)
+	{
+		futility_margin[d] = futility[d];
+		reverse_futility_margin[d] = reverse_futility[d];
+		razor_margin[d] = razor[d];
+	}
+	pawn = 100;
+	knight = 300;
+	bishop = 300;
+	rook = 500;
+	queen = 900;
+	tables = defaultTables();
+	mcts = NULL;
+	stop = false;
+	totals.clear();
+	search_ms = 0;
+	search_eval = 0;
+	EngineScope scope(this);
+	board.reset(new Board());
+	history.push_back(board->key);
+}
+
+Engine::~Engine()
+{
+	delete mcts;
+}
+
+void Engine::printStats(ostream& out)
+{
+	long long all = totals.total();
+	out << "Nodes: " << all << " (" << totals.qnodes << " in quiescence) Time: " << search_ms << " ms NPS: " << all * 1000 / max(search_ms, 1LL) << endl;
+	memory.flush();
+	out << "Memory: " << memory.total() / 1024 << " KB in use" << endl;
+#ifdef COUNT_ALLOCATIONS
+	out << "Allocations: " << totals.allocations << " (" << (double)totals.allocations / max(all, 1LL) << " per node), "
+		<< totals.hot_allocations << " below the root" << endl;
+#endif
+#ifdef SEARCH_STATS
+	// Effective branching factor is how many times more nodes each iteration took than the last
+	for (size_t i = 0; i < depth_nodes.size(); i++)
+	{
+		long long n = depth_nodes[i] - (i > 0 ? depth_nodes[i - 1] : 0);
+		out << "Depth " << i + 1 << ": " << n << " nodes " << depth_ms[i] << " ms";
+		if (i > 0 && depth_nodes[i - 1] - (i > 1 ? depth_nodes[i - 2] : 0) > 0)
+		{
+			out << " branching " << (double)n / (depth_nodes[i - 1] - (i > 1 ? depth_nodes[i - 2] : 0));
+		}
+		out << endl;
+	}
+	out << "Hash hits: " << totals.tt_hits * 100 / max(totals.tt_probes, 1LL) << "% of " << totals.tt_probes << " probes, " << totals.tt_cutoffs * 100 / max(totals.tt_probes, 1LL) << "% cut off" << endl;
+	out << "Fail high: " << totals.fail_highs << ", " << totals.first_move_fail_highs * 100 / max(totals.fail_highs, 1LL) << "% on the first move" << endl;
+	out << "Pruned: " << totals.futility_pruned << " futile, " << totals.reverse_futility_pruned << " reverse futile, " << totals.razored << " razored" << endl;
+#endif
+}
+
+bool Engine::configure(const string& options)
+{
+	stringstream in(options);
+	string option;
+	while (getline(in, option, ','))
+	{
+		size_t eq = option.find('=');
+		if (eq == string::npos)
+		{
+			return false;
+		}
+		string name = option.substr(0, eq);
+		string value = option.substr(eq + 1);
+		int v = atoi(value.c_str());
+		if (name == "depth")
+		{
+			depth = min(v, MAX_DEPTH);
+		}
+		else if (name == "ms")
+		{
+			time_ms = v;
+		}
+		else if (name == "nodes")
+		{
+			node_limit = atoll(value.c_str());
+		}
+		else if (name == "threads")
+		{
+			threads = v;
+		}
+		else if (name == "hash")
+		{
+			hash_mb = v;
+			tt.release();
+		}
+		else if (name == "backend")
+		{
+			backend = value == "ybwc" ? YBWC : (value == "mcts" ? MCTS : LAZY_SMP);
+		}
+		else if (name == "delta")
+		{
+			delta_margin = v;
+		}
+		else if (name == "pawn")
+		{
+			pawn = v;
+		}
+		else if (name == "knight")
+		{
+			knight = v;
+		}
+		else if (name == "bishop")
+		{
+			bishop = v;
+		}
+		else if (name == "rook")
+		{
+			rook = v;
+		}
+		else if (name == "queen")
+		{
+			queen = v;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void Engine::setPosition(const string& fen)
+{
+	EngineScope scope(this);
+	board.reset(new Board(fen));
+	history.assign(1, board->key);
+}
+
+void Engine::newGame(const string& fen)
+{
+	EngineScope scope(this);
+	setPosition(fen);
+	if (tt.entries != NULL)
+	{
+		tt.clear();
+	}
+	if (mcts != NULL)
+	{
+		mcts->root = -1;
+	}
+}
+
+bool Engine::play(Move* m)
+{
+	EngineScope scope(this);
+	Board* next = board->doMove(m->from_x, m->from_y, m->to_x, m->to_y, m->promotion_piece);
+	if (next == board.get())
+	{
+		return false;
+	}
+	board.reset(next);
+	history.push_back(board->key);
+	return true;
+}
+
+Move Engine::go()
+{
+	EngineScope scope(this);
+	key_history = history;
+	Board* result = think(board.get());
+	Move best = thinkMove(board.get(), result);
+	if (result != NULL && result != board.get())
+	{
+		delete result;
+	}
+	return best;
+}
+
+// One node on the explicit stack of a ResumableSearch, the locals getBest keeps on the call stack
+struct SearchFrame
+{
+	Board* board;
+	int depth;
+	int alpha;
+	int beta;
+	int alpha_orig;
+	bool pv_node;
+	bool first;
+	bool futile;
+	bool zero_window; // The child is searched with a zero window and may need a re-search
+	MoveList::iterator next; // Next move to try
+	Move* move; // Move to the child being searched
+	Board* child;
+	Move* best_move;
+	int best;
+};
+
+// Iterative deepening search that can stop after any node and carry on later, so many games
+// can share a few threads. Works like getBest with its recursion kept in a vector of frames,
+// quiescence at the leaves still runs to the end in one go
+class ResumableSearch {
+public:
+	Board* root;
+	vector<unsigned long long> history; // Keys of the game up to root, then the current search path
+	size_t game_length;
+	vector<SearchFrame> stack;
+	int max_depth;
+	long long node_budget; // 0 for no limit
+	long long ms_budget; // Thinking time, 0 for no limit
+	long long nodes; // Main search and quiescence nodes, as the engine's node limit counts them
+	int depth; // Iteration being searched
+	int completed_depth;
+	Move best; // Best move and score of the last finished iteration
+	int best_eval;
+	bool finished;
+	bool started;
+	chrono::steady_clock::time_point start;
+	int returned; // Score of the node that just finished, read by its parent
+	Move iteration_best;
+	bool iteration_has_best;
+
+	// b and game must stay the same until the search is finished, game ends with b's key
+	ResumableSearch(Board* b, const vector<unsigned long long>& game, int d, long long nodes_max = 0, long long ms_max = 0)
+	{
+		root = b;
+		history = game;
+		game_length = game.size();
+		max_depth = d;
+		node_budget = nodes_max;
+		ms_budget = ms_max;
+		nodes = 0;
+		depth = 1;
+		completed_depth = 0;
+		best_eval = 0;
+		finished = false;
+		started = false;
+		returned = 0;
+		iteration_has_best = false;
+		// A think on the same engine leaves stop set, which would cut every quiescence short
+		engine->stop = false;
+	}
+	~ResumableSearch()
+	{
+		abandon();
+	}
+	// Frees the boards of an unfinished iteration
+	void abandon()
+	{
+		for (auto& f : stack)
+		{
+			if (f.child != NULL)
+			{
+				delete f.child;
+			}
+		}
+		stack.clear();
+	}
+	bool outOfBudget()
+	{
+		if (node_budget > 0 && nodes >= node_budget)
+		{
+			return true;
+		}
+		return ms_budget > 0 && chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() >= ms_budget;
+	}
+	// Runs for about n more nodes, returns true once the search is finished
+	// The result is kept from the last finished iteration, at least depth 1 is always completed
+	bool step(int n)
+	{
+		if (finished)
+		{
+			return true;
+		}
+		if (!started)
+		{
+			start = chrono::steady_clock::now();
+			started = true;
+		}
+		key_history.swap(history);
+		long long stop = nodes + n;
+		bool over = completed_depth > 0 && outOfBudget();
+		while (!finished && nodes < stop)
+		{
+			if (over || (completed_depth > 0 && node_budget > 0 && nodes >= node_budget))
+			{
+				abandon();
+				finished = true;
+			}
+			else if (stack.empty())
+			{
+				if (depth > max_depth || root->moves.empty())
+				{
+					finished = true;
+				}
+				else
+				{
+					iteration_has_best = false;
+					enter(root, depth, -100000, 100000, true);
+				}
+			}
+			else
+			{
+				resume();
+			}
+		}
+		key_history.swap(history);
+		if (finished)
+		{
+			history.resize(game_length);
+		}
+		return finished;
+	}
+	// Quiescence search of b, its nodes count against the budget
+	int quiesce(Board* b, int alpha, int beta)
+	{
+		long long qnodes = counters.qnodes;
+		int score = b->quiesce(alpha, beta);
+		nodes += counters.qnodes - qnodes;
+		return score;
+	}
+	// Starts searching b, pushes a frame for it unless its score is known straight away
+	// Returns whether a frame was pushed, otherwise the score is in returned
+	bool enter(Board* b, int d, int alpha, int beta, bool pv_node)
+	{
+		bool root_node = stack.empty();
+		nodes++;
+		counters.nodes++;
+		if (!root_node && b->isDraw())
+		{
+			returned = 0;
+			return false;
+		}
+		if (d == 0)
+		{
+			returned = quiesce(b, alpha, beta);
+			return false;
+		}
+		bool in_check = b->isCheck(b->turn);
+		if (b->moves.empty())
+		{
+			returned = in_check ? -10000000 : 0;
+			return false;
+		}
+		int tt_score, tt_depth, tt_bound, tt_move;
+		if (engine->tt.probe(b->key, tt_score, tt_depth, tt_bound, tt_move))
+		{
+			if (!pv_node && tt_depth >= d && (tt_bound == TT_EXACT || (tt_bound == TT_LOWER && tt_score >= beta) || (tt_bound == TT_UPPER && tt_score <= alpha)))
+			{
+				returned = tt_score;
+				return false;
+			}
+			if (tt_move != 0)
+			{
+				for (MoveList::iterator i = b->moves.begin(); i != b->moves.end(); i++)
+				{
+					if (i->from_x == (tt_move & 7) && i->from_y == ((tt_move >> 3) & 7) && i->to_x == ((tt_move >> 6) & 7) && i->to_y == ((tt_move >> 9) & 7))
+					{
+						b->moves.moveToFront(i);
+						break;
+					}
+				}
+			}
+		}
+		bool futile = false;
+		if (!pv_node && !in_check && d < 4)
+		{
+			if (b->eval - engine->reverse_futility_margin[d] >= beta)
+			{
+				STAT(counters.reverse_futility_pruned++);
+				returned = b->eval - engine->reverse_futility_margin[d];
+				return false;
+			}
+			if (b->eval + engine->razor_margin[d] <= alpha)
+			{
+				int q = quiesce(b, alpha, beta);
+				if (q <= alpha)
+				{
+					STAT(counters.razored++);
+					returned = q;
+					return false;
+				}
+			}
+			futile = b->eval + engine->futility_margin[d] <= alpha;
+		}
+		SearchFrame f;
+		f.board = b;
+		f.depth = d;
+		f.alpha = alpha;
+		f.beta = beta;
+		f.alpha_orig = alpha;
+		f.pv_node = pv_node;
+		f.first = true;
+		f.futile = futile;
+		f.zero_window = false;
+		f.next = b->moves.begin();
+		f.move = NULL;
+		f.child = NULL;
+		f.best_move = NULL;
+		f.best = -10000000;
+		stack.push_back(f);
+		return true;
+	}
+	// Takes the score of the child that just finished, then moves on to the next child
+	void resume()
+	{
+		bool root_node = stack.size() == 1;
+		SearchFrame& f = stack.back();
+		if (f.child != NULL)
+		{
+			int score = -returned;
+			if (f.zero_window && score > f.alpha && score < f.beta)
+			{
+				// Beat alpha with the zero window, search it again with the full window
+				f.zero_window = false;
+				enter(f.child, f.depth - 1, -f.beta, -f.alpha, true);
+				return;
+			}
+			key_history.pop_back();
+			f.first = false;
+			if (score > f.best || (root_node && !iteration_has_best))
+			{
+				f.best = score;
+				f.best_move = f.move;
+				if (root_node)
+				{
+					iteration_best = *f.move;
+					iteration_has_best = true;
+				}
+				if (score > f.alpha)
+				{
+					f.alpha = score;
+				}
+			}
+			delete f.child;
+			f.child = NULL;
+			// Beta cutoff
+			if (f.best >= f.beta)
+			{
+				finish();
+				return;
+			}
+		}
+		while (f.next != f.board->moves.end())
+		{
+			Move* m = &*f.next;
+			f.next++;
+			Board* c;
+			if (f.futile && !f.first && f.board->captureValue(m) == 0 && !(f.board->squares[m->from_x][m->from_y] % 10 == 1 && (m->to_y == 0 || m->to_y == 7)))
+			{
+				Board quiet(f.board, m->from_x, m->from_y, m->to_x, m->to_y, m->black_castling_l, m->black_castling_r, m->white_castling_l, m->white_castling_r, m->promotion_piece, m->en_passant, 0);
+				if (!quiet.isCheck(quiet.turn))
+				{
+					STAT(counters.futility_pruned++);
+					continue;
+				}
+			}
+			c = new Board(f.board, m->from_x, m->from_y, m->to_x, m->to_y, m->black_castling_l, m->black_castling_r, m->white_castling_l, m->white_castling_r, m->promotion_piece, m->en_passant);
+			key_history.push_back(c->key);
+			f.move = m;
+			f.child = c;
+			f.zero_window = f.pv_node && !f.first;
+			int d = f.depth - 1;
+			int alpha = f.alpha;
+			int beta = f.beta;
+			bool pv = f.pv_node && f.first;
+			// f is not valid once enter pushes a frame
+			if (f.zero_window)
+			{
+				enter(c, d, -alpha - 1, -alpha, false);
+			}
+			else
+			{
+				enter(c, d, -beta, -alpha, pv);
+			}
+			return;
+		}
+		finish();
+	}
+	// Pops the top frame and hands its score to the parent
+	void finish()
+	{
+		SearchFrame& f = stack.back();
+		engine->tt.store(f.board->key, f.best, f.depth, f.best <= f.alpha_orig ? TT_UPPER : (f.best >= f.beta ? TT_LOWER : TT_EXACT), f.best_move);
+		returned = f.best;
+		stack.pop_back();
+		if (stack.empty())
+		{
+			best = iteration_best;
+			best_eval = returned;
+			completed_depth = depth;
+			depth++;
+		}
+	}
+};
+
+// Interleaves many resumable searches on a few threads. Each search runs for a slice of
+// nodes, then goes to the back of the queue until it is finished
+class SearchScheduler {
+public:
+	mutex lock;
+	condition_variable ready;
+	condition_variable idle;
+	deque<ResumableSearch*> queue;
+	int running; // Added and not finished yet
+	int slice;
+	bool quit;
+	vector<thread> workers;
+	function<void(ResumableSearch*)> done; // Called on a worker thread as each search finishes
+
+	SearchScheduler(int threads, int slice_nodes, function<void(ResumableSearch*)> on_done = nullptr)
+	{
+		running = 0;
+		slice = slice_nodes;
+		quit = false;
+		done = on_done;
+		for (int i = 0; i < max(1, threads); i++)
+		{
+			workers.push_back(thread(&SearchScheduler::workerLoop, this, engine, i));
+		}
+	}
+	~SearchScheduler()
+	{
+		{
+			lock_guard<mutex> l(lock);
+			quit = true;
+		}
+		ready.notify_all();
+		for (auto& t : workers)
+		{
+			t.join();
+		}
+	}
+	void add(ResumableSearch* s)
+	{
+		{
+			lock_guard<mutex> l(lock);
+			queue.push_back(s);
+			running++;
+		}
+		ready.notify_one();
+	}
+	// Blocks until every search added so far is finished
+	void wait()
+	{
+		unique_lock<mutex> l(lock);
+		idle.wait(l, [this]() { return running == 0; });
+	}
+	void workerLoop(Engine* e, int id)
+	{
+		EngineScope scope(e);
+		main_thread = false;
+		trace_thread_name = "scheduler worker";
+		pinThread(id);
+		unique_lock<mutex> l(lock);
+		while (true)
+		{
+			ready.wait(l, [this]() { return quit || !queue.empty(); });
+			if (queue.empty())
+			{
+				return;
+			}
+			ResumableSearch* s = queue.front();
+			queue.pop_front();
+			l.unlock();
+			long long slice_start = tracer.begin();
+			bool finished = s->step(slice);
+			tracer.end("slice", slice_start, s->completed_depth);
+			if (finished && done)
+			{
+				done(s);
+			}
+			l.lock();
+			if (finished)
+			{
+				running--;
+				if (running == 0)
+				{
+					idle.notify_all();
+				}
+			}
+			else
+			{
+				queue.push_back(s);
+			}
+		}
+	}
+};
+
+// A game held by the GameManager
+struct Game
+{
+	int id;
+	// Guards board, history and search, which the caller and the workers both use. A worker
+	// reads the board without it while the search runs, nothing may change it then
+	mutex lock;
+	Board* board;
+	vector<unsigned long long> history; // Keys of every position so far
+	// Budget for each engine move, 0 for no limit on nodes or time
+	int depth;
+	long long node_budget;
+	long long ms_budget;
+	ResumableSearch* search; // Engine move in progress, NULL when waiting for the other side
+	chrono::steady_clock::time_point requested; // When the engine move was queued
+	bool started; // The search has had its first slice
+	int engine_moves;
+	long long nodes;
+};
+
+// Value at fraction p of the list once sorted, the nearest one to it, 0 for an empty list
+double percentile(vector<double> v, double p)
+{
+	if (v.empty())
+	{
+		return 0;
+	}
+	sort(v.begin(), v.end());
+	return v[min(v.size() - 1, (size_t)(p * (v.size() - 1) + 0.5))];
+}
+
+// Holds many independent games and plays the engine's moves in them on a shared pool
+// Requests are spread over per-worker deques. Each worker serves its own deque oldest
+// first, a slice of nodes at a time, and steals from the others when it runs dry,
+// so every game gets its turn and no thread idles while work is queued
+class GameManager {
+public:
+	mutex lock; // Guards games and the metrics
+	vector<Game*> games;
+	vector<unique_ptr<WorkStealingDeque<Game*>>> queues;
+	vector<thread> workers;
+	mutex wake_lock;
+	condition_variable wake;
+	condition_variable idle;
+	int queued; // Games sitting in the deques
+	int pending; // Engine moves requested and not played yet
+	bool quit;
+	int slice;
+	atomic<unsigned> next_queue;
+	function<void(Game*, Move)> on_move; // Called on a worker thread after each engine move
+	// Metrics
+	chrono::steady_clock::time_point created;
+	long long moves_played;
+	long long total_nodes;
+	vector<double> queue_ms; // Request to first slice
+	vector<double> response_ms; // Request to move played
+
+	GameManager(int threads, int slice_nodes, function<void(Game*, Move)> callback = nullptr)
+	{
+		queued = 0;
+		pending = 0;
+		quit = false;
+		slice = slice_nodes;
+		next_queue = 0;
+		on_move = callback;
+		moves_played = 0;
+		total_nodes = 0;
+		created = chrono::steady_clock::now();
+		if (engine->tt.entries == NULL)
+		{
+			engine->tt.resize(engine->hash_mb);
+		}
+		for (int i = 0; i < max(1, threads); i++)
+		{
+			queues.push_back(unique_ptr<WorkStealingDeque<Game*>>(new WorkStealingDeque<Game*>()));
+		}
+		for (int i = 0; i < max(1, threads); i++)
+		{
+			workers.push_back(thread(&GameManager::workerLoop, this, engine, i));
+		}
+	}
+	~GameManager()
+	{
+		{
+			lock_guard<mutex> l(wake_lock);
+			quit = true;
+		}
+		wake.notify_all();
+		for (auto& t : workers)
+		{
+			t.join();
+		}
+		for (auto g : games)
+		{
+			endGame(g);
+		}
+	}
+	// Starts a game from fen (the starting position if empty), returns its id
+	int newGame(const string& fen, int depth, long long node_budget = 0, long long ms_budget = 0)
+	{
+		Game* g = new Game();
+		g->board = fen.empty() ? new Board() : new Board(fen);
+		g->history.push_back(g->board->key);
+		g->depth = max(1, depth); // A search that finishes no iteration has no move to play
+		g->node_budget = node_budget;
+		g->ms_budget = ms_budget;
+		g->search = NULL;
+		g->started = false;
+		g->engine_moves = 0;
+		g->nodes = 0;
+		lock_guard<mutex> l(lock);
+		g->id = (int)games.size();
+		games.push_back(g);
+		return g->id;
+	}
+	Game* game(int id)
+	{
+		lock_guard<mutex> l(lock);
+		return id >= 0 && id < (int)games.size() ? games[id] : NULL;
+	}
+	// Plays a move for the side not played by the engine, false if it is illegal or the engine is thinking
+	bool playMove(int id, int from_x, int from_y, int to_x, int to_y, int piece = 0)
+	{
+		Game* g = game(id);
+		if (g == NULL)
+		{
+			return false;
+		}
+		lock_guard<mutex> l(g->lock);
+		if (g->search != NULL)
+		{
+			return false;
+		}
+		Board* next = g->board->doMove(from_x, from_y, to_x, to_y, piece);
+		if (next == g->board)
+		{
+			return false;
+		}
+		delete g->board;
+		g->board = next;
+		g->history.push_back(next->key);
+		return true;
+	}
+	// Queues an engine move for the side to move, false if the game is over or already queued
+	bool requestMove(int id)
+	{
+		Game* g = game(id);
+		if (g == NULL)
+		{
+			return false;
+		}
+		{
+			lock_guard<mutex> l(g->lock);
+			if (g->search != NULL || g->board->moves.empty())
+			{
+				return false;
+			}
+			g->search = new ResumableSearch(g->board, g->history, g->depth, g->node_budget, g->ms_budget);
+			g->requested = chrono::steady_clock::now();
+			g->started = false;
+		}
+		{
+			lock_guard<mutex> l(wake_lock);
+			pending++;
+		}
+		enqueue(g, next_queue++ % queues.size());
+		return true;
+	}
+	// Blocks until every requested move has been played, including ones requested by on_move
+	void wait()
+	{
+		unique_lock<mutex> l(wake_lock);
+		idle.wait(l, [this]() { return pending == 0; });
+	}
+	void enqueue(Game* g, int queue)
+	{
+		queues[queue]->push(g);
+		{
+			lock_guard<mutex> l(wake_lock);
+			queued++;
+		}
+		wake.notify_one();
+	}
+	bool take(int id, Game*& g)
+	{
+		bool found = false;
+		for (int i = 0; i < (int)queues.size() && !found; i++)
+		{
+			found = queues[(id + i) % queues.size()]->steal(g);
+		}
+		if (found)
+		{
+			lock_guard<mutex> l(wake_lock);
+			queued--;
+		}
+		return found;
+	}
+	void workerLoop(Engine* e, int id)
+	{
+		EngineScope scope(e);
+		main_thread = false;
+		trace_thread_name = "game worker";
+		pinThread(id);
+		while (true)
+		{
+			Game* g = NULL;
+			if (!take(id, g))
+			{
+				unique_lock<mutex> l(wake_lock);
+				wake.wait(l, [this]() { return quit || queued > 0; });
+				if (quit)
+				{
+					return;
+				}
+				continue;
+			}
+			if (!g->started)
+			{
+				g->started = true;
+				double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - g->requested).count();
+				lock_guard<mutex> l(lock);
+				queue_ms.push_back(ms);
+			}
+			long long slice_start = tracer.begin();
+			bool finished = g->search->step(slice);
+			tracer.end("slice", slice_start, g->id);
+			if (finished)
+			{
+				finishMove(g);
+			}
+			else
+			{
+				enqueue(g, id);
+			}
+		}
+	}
+	// Plays the result of a finished search
+	void finishMove(Game* g)
+	{
+		ResumableSearch* s;
+		Move m;
+		{
+			lock_guard<mutex> l(g->lock);
+			s = g->search;
+			// Only set once an iteration has finished, requestMove made sure there is a legal move
+			m = s->completed_depth > 0 ? s->best : *g->board->moves.begin();
+			Board* next = new Board(g->board, m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant);
+			delete g->board;
+			g->board = next;
+			g->history.push_back(next->key);
+			g->engine_moves++;
+			g->nodes += s->nodes;
+			g->search = NULL;
+		}
+		{
+			lock_guard<mutex> l(lock);
+			moves_played++;
+			total_nodes += s->nodes;
+			response_ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - g->requested).count());
+		}
+		delete s;
+		// Called without the game's lock, so it can request the next move
+		if (on_move)
+		{
+			on_move(g, m);
+		}
+		lock_guard<mutex> l(wake_lock);
+		pending--;
+		if (pending == 0)
+		{
+			idle.notify_all();
+		}
+	}
+	// Frees a game, it must not have a move queued
+	void endGame(Game* g)
+	{
+		if (g == NULL)
+		{
+			return;
+		}
+		{
+			lock_guard<mutex> l(lock);
+			games[g->id] = NULL;
+		}
+		delete g->search;
+		delete g->board;
+		delete g;
+	}
+	void report(ostream& out)
+	{
+		lock_guard<mutex> l(lock);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - created).count();
+		out << "Moves: " << moves_played << " (" << moves_played / max(seconds, 0.001) << " per second)" << endl;
+		out << "Nodes: " << total_nodes << " (" << (long long)(total_nodes / max(seconds, 0.001)) << " per second)" << endl;
+		out << "Queue latency ms: median " << percentile(queue_ms, 0.5) << " p95 " << percentile(queue_ms, 0.95) << " max " << percentile(queue_ms, 1) << endl;
+		out << "Response ms: median " << percentile(response_ms, 0.5) << " p95 " << percentile(response_ms, 0.95) << " max " << percentile(response_ms, 1) << endl;
+	}
+};
+
+// Perft counts the positions at the end of every move sequence of a given length,
+// used to check the move generator against known totals and to time it
+// Subtree totals are cached by key and depth, so transposed subtrees are only counted once
+struct PerftEntry
+{
+	atomic<unsigned long long> check; // key ^ count, same lockless scheme as the transposition table
+	atomic<unsigned long long> count;
+};
+
+class PerftTable {
+public:
+	PerftEntry* entries;
+	size_t size;
+	bool huge;
+
+	PerftTable(int mb)
+	{
+		entries = NULL;
+		size = 0;
+		huge = false;
+		if (mb > 0)
+		{
+			size = 1;
+			while (size * 2 * sizeof(PerftEntry) <= (size_t)mb * 1024 * 1024)
+			{
+				size *= 2;
+			}
+			entries = (PerftEntry*)allocLarge(size * sizeof(PerftEntry), huge, MEM_TABLES);
+			PerftEntry* e = entries;
+			parallelSlices(size, [e](size_t first, size_t last)
+			{
+				for (size_t i = first; i < last; i++)
+				{
+					new (&e[i]) PerftEntry();
+					e[i].check = 0;
+					e[i].count = 0;
+				}
+			});
+		}
+	}
+	~PerftTable()
+	{
+		freeLarge(entries, size * sizeof(PerftEntry), MEM_TABLES);
+	}
+	// Depth is mixed into the key so the same position at another depth is a different entry
+	unsigned long long mix(unsigned long long key, int depth)
+	{
+		return key ^ ((unsigned long long)depth * 0x9E3779B97F4A7C15ULL);
+	}
+	bool probe(unsigned long long key, int depth, unsigned long long& count)
+	{
+		if (size == 0)
+		{
+			return false;
+		}
+		unsigned long long k = mix(key, depth);
+		PerftEntry& e = entries[k & (size - 1)];
+		unsigned long long stored = e.count.load(memory_order_relaxed);
+		if ((e.check.load(memory_order_relaxed) ^ stored) != k)
+		{
+			return false;
+		}
+		count = stored;
+		return true;
+	}
+	void store(unsigned long long key, int depth, unsigned long long count)
+	{
+		if (size == 0)
+		{
+			return;
+		}
+		unsigned long long k = mix(key, depth);
+		PerftEntry& e = entries[k & (size - 1)];
+		e.check.store(k ^ count, memory_order_relaxed);
+		e.count.store(count, memory_order_relaxed);
+	}
+};
+
+unsigned long long perft(Board* b, int depth, PerftTable* table)
+{
+	unsigned long long count = 0;
+	if (depth == 0)
+	{
+		return 1;
+	}
+	// Moves are already generated and checked for legality, so the last ply is just a count
+	if (depth == 1)
+	{
+		return b->moves.size();
+	}
+	if (table->probe(b->key, depth, count))
+	{
+		return count;
+	}
+	for (MoveList::iterator i = b->moves.begin(); i != b->moves.end(); i++)
+	{
+		Board* c = new Board(b, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant);
+		count += perft(c, depth - 1, table);
+		delete c;
+	}
+	table->store(b->key, depth, count);
+	return count;
+}
+
+// Piece of perft work, the subtree below one position at the split depth
+struct PerftTask
+{
+	int root_move; // Index of the root move the position came from
+	Board* board;
+};
+
+// Collects every position split plies below b as tasks
+void perftTasks(Board* b, int split, int root_move, vector<PerftTask>& tasks)
+{
+	int index = 0;
+	for (MoveList::iterator i = b->moves.begin(); i != b->moves.end(); i++, index++)
+	{
+		Board* c = new Board(b, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant);
+		int move = root_move == -1 ? index : root_move;
+		if (split == 1)
+		{
+			PerftTask t;
+			t.root_move = move;
+			t.board = c;
+			tasks.push_back(t);
+		}
+		else
+		{
+			perftTasks(c, split - 1, move, tasks);
+			delete c;
+		}
+	}
+}
+
+// Perft split across threads, divide gets the count below each root move
+// Threads take tasks in order from a shared counter
+unsigned long long parallelPerft(Board* b, int depth, int threads, int split, int hash_mb, vector<unsigned long long>& divide)
+{
+	PerftTable table(hash_mb);
+	vector<PerftTask> tasks;
+	vector<atomic<unsigned long long>> counts(b->moves.size());
+	atomic<int> next(0);
+	divide.assign(b->moves.size(), 0);
+	if (depth == 0)
+	{
+		return 1;
+	}
+	split = max(1, min(split, depth));
+	perftTasks(b, split, -1, tasks);
+	for (auto& c : counts)
+	{
+		c = 0;
+	}
+	Engine* e = engine;
+	auto work = [&](int index)
+	{
+		EngineScope scope(e);
+		pinThread(index);
+		for (int t = next++; t < (int)tasks.size(); t = next++)
+		{
+			counts[tasks[t].root_move] += perft(tasks[t].board, depth - split, &table);
+		}
+	};
+	vector<thread> pool;
+	for (int i = 1; i < threads; i++)
+	{
+		pool.push_back(thread(work, i));
+	}
+	work(0);
+	for (auto& t : pool)
+	{
+		t.join();
+	}
+	unsigned long long total = 0;
+	for (int i = 0; i < (int)counts.size(); i++)
+	{
+		divide[i] = counts[i];
+		total += divide[i];
+	}
+	for (auto& t : tasks)
+	{
+		delete t.board;
+	}
+	return total;
+}
+
+// Positions with known perft counts: the standard start, Kiwipete and positions 3 to 6,
+// then short cases for en passant pins, castling through or into check and promotions
+struct PerftReference
+{
+	const char* name;
+	const char* fen;
+	unsigned long long nodes[7]; // Expected count at depth 1 to 7, 0 where not listed
+};
+
+const PerftReference PERFT_SUITE[] = {
+	{ "start", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", { 20, 400, 8902, 197281, 4865609, 119060324, 0 } },
+	{ "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", { 48, 2039, 97862, 4085603, 193690690, 0, 0 } },
+	{ "position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", { 14, 191, 2812, 43238, 674624, 11030083, 178633661 } },
+	{ "position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", { 6, 264, 9467, 422333, 15833292, 706045033, 0 } },
+	{ "position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", { 44, 1486, 62379, 2103487, 89941194, 0, 0 } },
+	{ "position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", { 46, 2079, 89890, 3894594, 164075551, 0, 0 } },
+	{ "illegal en passant 1", "3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", { 0, 0, 0, 0, 0, 1134888, 0 } },
+	{ "illegal en passant 2", "8/8/4k3/8/2p5/8/B2P2K1/8 w - - 0 1", { 0, 0, 0, 0, 0, 1015133, 0 } },
+	{ "illegal en passant 3", "8/8/1k6/8/2pP4/8/5BK1/8 b - d3 0 1", { 0, 0, 0, 0, 0, 824064, 0 } },
+	{ "en passant gives check", "8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", { 0, 0, 0, 0, 0, 1440467, 0 } },
+	{ "short castle gives check", "5k2/8/8/8/8/8/8/4K2R w K - 0 1", { 0, 0, 0, 0, 0, 661072, 0 } },
+	{ "long castle gives check", "3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", { 0, 0, 0, 0, 0, 803711, 0 } },
+	{ "castling rights", "r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", { 0, 0, 0, 1274206, 0, 0, 0 } },
+	{ "castling prevented", "r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", { 0, 0, 0, 1720476, 0, 0, 0 } },
+	{ "promote out of check", "2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1", { 0, 0, 0, 0, 0, 3821001, 0 } },
+	{ "discovered check", "8/8/1P2K3/8/2n5/1q6/8/5k2 b - - 0 1", { 0, 0, 0, 0, 1004658, 0, 0 } },
+	{ "promote to give check", "4k3/1P6/8/8/8/8/K7/8 w - - 0 1", { 0, 0, 0, 0, 0, 217342, 0 } },
+	{ "underpromote to check", "8/P1k5/K7/8/8/8/8/8 w - - 0 1", { 0, 0, 0, 0, 0, 92683, 0 } },
+	{ "self stalemate", "K1k5/8/P7/8/8/8/8/8 w - - 0 1", { 0, 0, 0, 0, 0, 2217, 0 } },
+	{ "stalemate and checkmate 1", "8/k1P5/8/1K6/8/8/8/8 w - - 0 1", { 0, 0, 0, 0, 0, 0, 567584 } },
+	{ "stalemate and checkmate 2", "8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", { 0, 0, 0, 23527, 0, 0, 0 } },
+};
+
+// Runs every count in PERFT_SUITE up to max_nodes and prints each result with its speed
+// Returns the number of mismatches
+int perftSuite(unsigned long long max_nodes, int threads, int hash_mb)
+{
+	int runs = 0, mismatches = 0;
+	unsigned long long total = 0;
+	double total_seconds = 0;
+	for (auto& r : PERFT_SUITE)
+	{
+		Board* b = new Board(r.fen);
+		for (int d = 1; d <= 7; d++)
+		{
+			if (r.nodes[d - 1] == 0 || r.nodes[d - 1] > max_nodes)
+			{
+				continue;
+			}
+			vector<unsigned long long> divide;
+			auto start = chrono::steady_clock::now();
+			unsigned long long count = parallelPerft(b, d, threads, 1, hash_mb, divide);
+			double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			runs++;
+			total += count;
+			total_seconds += seconds;
+			cout << r.name << " depth " << d << ": " << count;
+			if (count != r.nodes[d - 1])
+			{
+				mismatches++;
+				cout << " MISMATCH, expected " << r.nodes[d - 1] << " (divide with: perft " << d << " \"" << r.fen << "\")";
+			}
+			cout << " " << (long long)(seconds * 1000) << " ms " << (long long)(count / max(seconds, 0.001)) << " nps" << endl;
+		}
+		delete b;
+	}
+	cout << endl << runs - mismatches << " of " << runs << " passed" << endl;
+	cout << "Nodes: " << total << " Time: " << (long long)(total_seconds * 1000) << " ms NPS: " << (long long)(total / max(total_seconds, 0.001)) << endl;
+	return mismatches;
+}
+
+// Fixed positions searched by the bench command: middlegames from real games, the perft
+// positions and endgames where the pieces run out, all to one depth on one thread
+const char* BENCH_POSITIONS[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+	"4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+	"rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+	"r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+	"r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+	"r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+	"r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+	"4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+	"2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+	"r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+	"3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+	"r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+	"4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+	"3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+	"6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/8 b - - 0 1",
+	"3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+	"2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+	"8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+	"7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+	"8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+	"8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+	"8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+	"8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+	"5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+	"6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+	"1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+	"6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+	"8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+	"5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+	"4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+	"r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+	"3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+	"4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+	"8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+	"8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+	"8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+	"8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+	"8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+	"8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+	"8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+	"6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+	"r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+	"8/8/8/8/8/6k1/6p1/4K3 w - - 0 1",
+	"7k/8/6KP/8/3B4/8/8/8 b - - 0 1",
+	"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+	"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+	"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	"rnbqkb1r/pp1p1ppp/4pn2/2p5/2PP4/2N5/PP2PPPP/R1BQKBNR w KQkq - 0 4",
+};
+
+struct BenchResult
+{
+	long long nodes; // Main search plus quiescence nodes, the signature of the search
+	double seconds;
+	// Calls to operator new in the searches and the ones below the root, only counted
+	// in builds with COUNT_ALLOCATIONS
+	long long allocations;
+	long long hot_allocations;
+};
+
+// Searches every bench position to depth with an empty hash table each time. With one
+// thread the node total only changes when the search itself does
+BenchResult bench(int depth, int threads, SearchBackend backend, bool verbose)
+{
+	BenchResult r = { 0, 0, 0, 0 };
+	int saved_depth = engine->depth, saved_threads = engine->threads, saved_ms = engine->time_ms;
+	SearchBackend saved_backend = engine->backend;
+	engine->depth = depth;
+	engine->threads = threads;
+	engine->time_ms = 0;
+	engine->backend = backend;
+	if (engine->tt.entries == NULL)
+	{
+		engine->tt.resize(engine->hash_mb);
+	}
+	int i = 0;
+	for (const char* fen : BENCH_POSITIONS)
+	{
+		Board* b = new Board(fen);
+		engine->tt.clear();
+		key_history.clear();
+		key_history.push_back(b->key);
+		auto start = chrono::steady_clock::now();
+		Board* result = think(b);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		long long nodes = engine->totals.total();
+		r.nodes += nodes;
+		r.seconds += seconds;
+		ALLOC(r.allocations += engine->totals.allocations);
+		ALLOC(r.hot_allocations += engine->totals.hot_allocations);
+		if (verbose)
+		{
+			cout << "Position " << ++i << ": " << nodes << " nodes " << (long long)(seconds * 1000) << " ms";
+			ALLOC(cout << " " << engine->totals.hot_allocations << " allocations below the root");
+			if (!engine->search_line.empty())
+			{
+				cout << " " << moveName(&engine->search_line[0]);
+			}
+			cout << endl;
+		}
+		if (result != NULL && result != b)
+		{
+			delete result;
+		}
+		delete b;
+	}
+	engine->depth = saved_depth;
+	engine->threads = saved_threads;
+	engine->time_ms = saved_ms;
+	engine->backend = saved_backend;
+	return r;
+}
+
+// Time stamp counter for cycles per call, 0 where there is none. These are reference
+// cycles at the nominal clock, not the core clock under turbo
+unsigned long long readCycles()
+{
+#if defined(_WIN32) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// Runs the bench at 1, 2, 4 and so on up to max_threads, then at max_threads itself, and
+// compares each to one thread: time to reach the depth, nodes per second and the extra
+// nodes the threads search to get there
+void scaling(int depth, int max_threads, SearchBackend backend)
+{
+	cout << "Bench depth " << depth << " with the " << (backend == YBWC ? "YBWC" : "Lazy SMP") << " backend, "
+		<< thread::hardware_concurrency() << " hardware threads" << endl;
+	ios_base::fmtflags flags = cout.flags();
+	streamsize precision = cout.precision();
+	cout << left << setw(9) << "Threads" << setw(10) << "Time ms" << setw(9) << "Speedup" << setw(12) << "Nodes"
+		<< setw(10) << "Overhead" << setw(10) << "NPS" << "NPS speedup" << endl;
+	cout << fixed << setprecision(2);
+	BenchResult base = { 0, 0, 0, 0 };
+	vector<int> counts;
+	for (int t = 1; t < max_threads; t *= 2)
+	{
+		counts.push_back(t);
+	}
+	counts.push_back(max(1, max_threads));
+	for (int t : counts)
+	{
+		BenchResult r = bench(depth, t, backend, false);
+		if (t == 1)
+		{
+			base = r;
+		}
+		double nps = r.nodes / max(r.seconds, 0.001);
+		double base_nps = base.nodes / max(base.seconds, 0.001);
+		cout << setw(9) << t << setw(10) << (long long)(r.seconds * 1000) << setw(9) << base.seconds / max(r.seconds, 0.001)
+			<< setw(12) << r.nodes << setw(10) << to_string((int)((double)r.nodes / base.nodes * 100 - 100)) + "%"
+			<< setw(10) << (long long)nps << nps / base_nps << endl;
+	}
+	cout.flags(flags);
+	cout.precision(precision);
+}
+
+// Timings of one primitive, per call over every sample
+struct MicroResult
+{
+	string name;
+	long long calls; // Calls in one sample
+	vector<double> ns;
+	vector<double> cycles;
+};
+
+// Runs a batch of calls samples times after a few warmup batches. Batches are timed as a
+// whole since the cheaper primitives take less than a clock read. prepare and cleanup are
+// left out of the timing
+MicroResult microMeasure(const string& name, int samples, function<long long()> run, function<void()> prepare, function<void()> cleanup)
+{
+	MicroResult r;
+	r.name = name;
+	r.calls = 0;
+	for (int i = -3; i < samples; i++)
+	{
+		prepare();
+		auto start = chrono::steady_clock::now();
+		unsigned long long start_cycles = readCycles();
+		long long calls = run();
+		unsigned long long cycles = readCycles() - start_cycles;
+		double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+		cleanup();
+		if (i >= 0 && calls > 0)
+		{
+			r.calls = calls;
+			r.ns.push_back(ns / calls);
+			r.cycles.push_back((double)cycles / calls);
+		}
+	}
+	return r;
+}
+
+// Times each of the board primitives the search is built from over the bench positions:
+// copying a board, making a move without and with move generation, findMoves, checkMove
+// for every legal move, isCheck for both sides, evaluate and the doMove lookup
+// Prints a table and writes the results as JSON to json_path if it is given
+vector<MicroResult> microbench(int samples, const string& json_path)
+{
+	vector<Board*> boards;
+	for (const char* fen : BENCH_POSITIONS)
+	{
+		boards.push_back(new Board(fen));
+	}
+	auto none = [] {};
+	// Move lists are set aside while findMoves and checkMove fill new ones
+	vector<MoveList> saved;
+	auto swapLists = [&] {
+		for (Board* b : boards)
+		{
+			saved.push_back(b->moves);
+			b->moves.clear();
+		}
+	};
+	auto restoreLists = [&] {
+		for (size_t i = 0; i < boards.size(); i++)
+		{
+			boards[i]->moves = saved[i];
+		}
+		saved.clear();
+	};
+	vector<MicroResult> results;
+	results.push_back(microMeasure("copy", samples, [&] {
+		for (Board* b : boards)
+		{
+			delete new Board(b);
+		}
+		return (long long)boards.size();
+	}, none, none));
+	results.push_back(microMeasure("make", samples, [&] {
+		long long calls = 0;
+		for (Board* b : boards)
+		{
+			for (auto& m : b->moves)
+			{
+				delete new Board(b, m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant, 0);
+				calls++;
+			}
+		}
+		return calls;
+	}, none, none));
+	results.push_back(microMeasure("make with moves", samples, [&] {
+		long long calls = 0;
+		for (Board* b : boards)
+		{
+			for (auto& m : b->moves)
+			{
+				delete new Board(b, m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant);
+				calls++;
+			}
+		}
+		return calls;
+	}, none, none));
+	results.push_back(microMeasure("findMoves", samples, [&] {
+		for (Board* b : boards)
+		{
+			b->findMoves();
+		}
+		return (long long)boards.size();
+	}, swapLists, restoreLists));
+	results.push_back(microMeasure("checkMove", samples, [&] {
+		long long calls = 0;
+		for (size_t i = 0; i < boards.size(); i++)
+		{
+			for (auto& m : saved[i])
+			{
+				boards[i]->checkMove(m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant);
+				calls++;
+			}
+		}
+		return calls;
+	}, swapLists, restoreLists));
+	int checks = 0; // Kept so the calls are not optimized out
+	results.push_back(microMeasure("isCheck", samples, [&] {
+		for (Board* b : boards)
+		{
+			checks += b->isCheck(true) + b->isCheck(false);
+		}
+		return (long long)boards.size() * 2;
+	}, none, none));
+	results.push_back(microMeasure("evaluate", samples, [&] {
+		for (Board* b : boards)
+		{
+			b->evaluate();
+		}
+		return (long long)boards.size();
+	}, none, none));
+	// Finding the move in the list, the last generated is the longest lookup, then making
+	// it with its moves. Less "make with moves" is the cost of the lookup
+	results.push_back(microMeasure("doMove with make", samples, [&] {
+		long long calls = 0;
+		for (Board* b : boards)
+		{
+			if (!b->moves.empty())
+			{
+				Move* m = &b->moves.back();
+				Board* next = b->doMove(m->from_x, m->from_y, m->to_x, m->to_y, m->promotion_piece);
+				if (next != b)
+				{
+					delete next;
+				}
+				calls++;
+			}
+		}
+		return calls;
+	}, none, none));
+	for (Board* b : boards)
+	{
+		delete b;
+	}
+	ios_base::fmtflags flags = cout.flags();
+	streamsize precision = cout.precision();
+	cout << left << setw(18) << "Primitive" << setw(10) << "Calls" << setw(12) << "Median ns" << setw(10) << "P10 ns" << setw(10) << "P90 ns" << setw(10) << "P99 ns" << "Cycles" << endl;
+	cout << fixed << setprecision(1);
+	for (auto& r : results)
+	{
+		cout << setw(18) << r.name << setw(10) << r.calls << setw(12) << percentile(r.ns, 0.5) << setw(10) << percentile(r.ns, 0.1)
+			<< setw(10) << percentile(r.ns, 0.9) << setw(10) << percentile(r.ns, 0.99) << percentile(r.cycles, 0.5) << endl;
+	}
+	cout.flags(flags);
+	cout.precision(precision);
+	if (checks < 0)
+	{
+		cout << checks << endl;
+	}
+	if (!json_path.empty())
+	{
+		ofstream out(json_path);
+		out << "{\n  \"positions\": " << boards.size() << ",\n  \"samples\": " << samples << ",\n  \"primitives\": [\n";
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			MicroResult& r = results[i];
+			out << "    { \"name\": \"" << r.name << "\", \"calls\": " << r.calls
+				<< ", \"median_ns\": " << percentile(r.ns, 0.5) << ", \"p10_ns\": " << percentile(r.ns, 0.1)
+				<< ", \"p90_ns\": " << percentile(r.ns, 0.9) << ", \"p99_ns\": " << percentile(r.ns, 0.99)
+				<< ", \"min_ns\": " << percentile(r.ns, 0) << ", \"max_ns\": " << percentile(r.ns, 1)
+				<< ", \"median_cycles\": " << percentile(r.cycles, 0.5) << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		out << "  ]\n}\n";
+	}
+	return results;
+}
+
+// How a game stands, see gameResult
+enum GameResult { ONGOING, WHITE_WINS, BLACK_WINS, DRAWN };
+
+// Whether the engine's game is over: mate, stalemate, the fifty move rule, threefold
+// repetition, or too little material left to mate
+GameResult gameResult(Engine* e)
+{
+	Board* b = e->board.get();
+	if (b->moves.empty())
+	{
+		if (b->isCheck(b->turn))
+		{
+			return b->turn ? BLACK_WINS : WHITE_WINS;
+		}
+		return DRAWN;
+	}
+	if (b->halfmove >= 100 || count(e->history.begin(), e->history.end(), b->key) >= 3)
+	{
+		return DRAWN;
+	}
+	int minors = 0, others = 0;
+	for (int x = 0; x < 8; x++)
+	{
+		for (int y = 0; y < 8; y++)
+		{
+			int p = b->squares[x][y] % 10;
+			if (p == 2 || p == 3)
+			{
+				minors++;
+			}
+			else if (p != 0 && p != 6)
+			{
+				others++;
+			}
+		}
+	}
+	return others == 0 && minors <= 1 ? DRAWN : ONGOING;
+}
+
+// Plays a game between two engines from a position, each searching with its own settings
+// Both start with empty hash tables. Games longer than max_plies are called drawn
+GameResult playGame(Engine* white, Engine* black, const string& fen, int max_plies)
+{
+	white->newGame(fen);
+	black->newGame(fen);
+	for (int ply = 0; ply < max_plies; ply++)
+	{
+		GameResult r = gameResult(white);
+		if (r != ONGOING)
+		{
+			return r;
+		}
+		Engine* mover = white->board->turn ? white : black;
+		Move m = mover->go();
+		// A move the other side does not have is a bug, and loses
+		if (!white->play(&m) || !black->play(&m))
+		{
+			return mover == white ? BLACK_WINS : WHITE_WINS;
+		}
+	}
+	return DRAWN;
+}
+
+// Log likelihood ratio of the hypothesis that A is elo1 stronger against elo0 stronger,
+// from the normal approximation of the win, draw and loss counts
+double sprtLLR(int wins, int draws, int losses, double elo0, double elo1)
+{
+	double n = wins + draws + losses;
+	if (n == 0)
+	{
+		return 0;
+	}
+	double score = (wins + draws / 2.0) / n;
+	double variance = (wins * pow(1 - score, 2) + draws * pow(0.5 - score, 2) + losses * pow(score, 2)) / n;
+	if (variance <= 0)
+	{
+		return 0;
+	}
+	double s0 = 1 / (1 + pow(10, -elo0 / 400));
+	double s1 = 1 / (1 + pow(10, -elo1 / 400));
+	return n * (s1 - s0) * (2 * score - s0 - s1) / (2 * variance);
+}
+
+// Elo difference for a score fraction
+double eloFromScore(double score)
+{
+	score = max(0.001, min(0.999, score));
+	return -400 * log10(1 / score - 1);
+}
+
+// Plays games between engine settings A and B on threads at once until the games run out
+// or the sequential probability ratio test accepts elo0 or elo1. Each opening is played
+// twice with the colours swapped. Returns 1 if elo1 was accepted, -1 for elo0, else 0
+int runMatch(const string& options_a, const string& options_b, int games, int threads, const vector<string>& openings, double elo0, double elo1, double alpha, double beta)
+{
+	const double lower = log(beta / (1 - alpha));
+	const double upper = log((1 - beta) / alpha);
+	atomic<int> next(0);
+	mutex lock;
+	int wins = 0, draws = 0, losses = 0, decision = 0;
+	auto start = chrono::steady_clock::now();
+	auto worker = [&]()
+	{
+		Engine a, b;
+		a.hash_mb = 16;
+		b.hash_mb = 16;
+		a.configure(options_a);
+		b.configure(options_b);
+		while (true)
+		{
+			int i = next++;
+			{
+				lock_guard<mutex> l(lock);
+				if (i >= games || decision != 0)
+				{
+					return;
+				}
+			}
+			bool a_white = i % 2 == 0;
+			GameResult r = playGame(a_white ? &a : &b, a_white ? &b : &a, openings[(i / 2) % openings.size()], 400);
+			lock_guard<mutex> l(lock);
+			if (r == DRAWN)
+			{
+				draws++;
+			}
+			else if ((r == WHITE_WINS) == a_white)
+			{
+				wins++;
+			}
+			else
+			{
+				losses++;
+			}
+			int n = wins + draws + losses;
+			double llr = sprtLLR(wins, draws, losses, elo0, elo1);
+			double score = (wins + draws / 2.0) / n;
+			double margin = 1.96 * sqrt(max(0.0, (wins * pow(1 - score, 2) + draws * pow(0.5 - score, 2) + losses * pow(score, 2)) / n) / n);
+			cout << "Game " << i + 1 << " A " << (a_white ? "white" : "black") << ": " << (r == DRAWN ? "1/2-1/2" : (r == WHITE_WINS ? "1-0" : "0-1"));
+			cout << "  A " << wins << " - " << losses << " - " << draws << "  Elo " << (int)eloFromScore(score) << " (" << (int)eloFromScore(score - margin) << " to " << (int)eloFromScore(score + margin) << ")";
+			cout << "  LLR " << llr << " (" << lower << ", " << upper << ")" << endl;
+			if (decision == 0 && llr >= upper)
+			{
+				decision = 1;
+			}
+			else if (decision == 0 && llr <= lower)
+			{
+				decision = -1;
+			}
+		}
+	};
+	vector<thread> pool;
+	for (int t = 0; t < threads; t++)
+	{
+		pool.push_back(thread(worker));
+	}
+	for (auto& t : pool)
+	{
+		t.join();
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << endl << wins + draws + losses << " games in " << (long long)seconds << " s, A won " << wins << ", lost " << losses << ", drew " << draws << endl;
+	if (decision == 1)
+	{
+		cout << "SPRT accepted elo1: A is at least " << elo1 << " Elo stronger" << endl;
+	}
+	else if (decision == -1)
+	{
+		cout << "SPRT accepted elo0: A is not more than " << elo0 << " Elo stronger" << endl;
+	}
+	else
+	{
+		cout << "SPRT undecided after the games given" << endl;
+	}
+	return decision;
+}
+
+// Commit the program was built from, given to the compiler as -DGIT_COMMIT=\"...\". Without it
+// git is asked for the commit checked out where the program runs, which is the same one as
+// long as it is run from the tree it was built in
+string buildCommit()
+{
+#ifdef GIT_COMMIT
+	return GIT_COMMIT;
+#else
+	static string commit;
+	if (commit.empty())
+	{
+#ifdef _WIN32
+		FILE* out = _popen("git rev-parse --short HEAD 2>NUL", "r");
+#else
+		FILE* out = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+#endif
+		char line[64] = {};
+		if (out != NULL)
+		{
+			if (fgets(line, sizeof(line), out) == NULL)
+			{
+				line[0] = 0;
+			}
+#ifdef _WIN32
+			_pclose(out);
+#else
+			pclose(out);
+#endif
+		}
+		commit = strtok(line, "\r\n") != NULL ? line : "unknown";
+	}
+	return commit;
+#endif
+}
+
+string jsonEscape(const string& s)
+{
+	string out;
+	for (char c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+		}
+		if ((unsigned char)c >= 32)
+		{
+			out += c;
+		}
+	}
+	return out;
+}
+
+// Name of the processor, from the kernel or the CPUID brand string
+string cpuModel()
+{
+#ifdef _WIN32
+	int info[4];
+	char brand[49] = {};
+	__cpuid(info, 0x80000000);
+	if ((unsigned int)info[0] >= 0x80000004)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			__cpuid(info, 0x80000002 + i);
+			memcpy(brand + i * 16, info, 16);
+		}
+		return brand;
+	}
+#else
+	ifstream in("/proc/cpuinfo");
+	string line;
+	while (getline(in, line))
+	{
+		if (line.compare(0, 10, "model name") == 0 && line.find(':') != string::npos)
+		{
+			return line.substr(line.find(':') + 2);
+		}
+	}
+#endif
+	return "unknown";
+}
+
+// Appends one result to a file of JSON lines, with the date, build and machine it came from
+// so results from different commits and computers can be told apart later
+// fields is the rest of the object, such as "\"nodes\": 100"
+bool recordResult(const string& path, const string& command, const string& fields)
+{
+	ofstream out(path, ios::app);
+	if (!out)
+	{
+		cout << "Could not record the result in " << path << endl;
+		return false;
+	}
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+#if defined(_MSC_VER)
+	string compiler = "MSVC " + to_string(_MSC_FULL_VER);
+#elif defined(__clang__)
+	string compiler = "Clang " __clang_version__;
+#elif defined(__GNUC__)
+	string compiler = "GCC " __VERSION__;
+#else
+	string compiler = "unknown";
+#endif
+	out << "{\"date\": \"" << date << "\", \"command\": \"" << command << "\", \"commit\": \"" << jsonEscape(buildCommit())
+		<< "\", \"compiler\": \"" << jsonEscape(compiler) << "\", \"cpu\": \"" << jsonEscape(cpuModel())
+		<< "\", \"threads\": " << thread::hardware_concurrency() << ", " << fields << "}" << endl;
+	return true;
+}
+
+// Mean and sample variance of a list of measurements
+void meanVariance(const vector<double>& v, double& mean, double& variance)
+{
+	mean = 0;
+	for (double x : v)
+	{
+		mean += x;
+	}
+	mean /= v.size();
+	variance = 0;
+	for (double x : v)
+	{
+		variance += (x - mean) * (x - mean);
+	}
+	variance = v.size() > 1 ? variance / (v.size() - 1) : 0;
+}
+
+// Two sided 95% critical value of Student's t distribution
+double tCritical(double df)
+{
+	const double table[] = { 12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23, 2.20, 2.18, 2.16, 2.14, 2.13,
+		2.12, 2.11, 2.10, 2.09, 2.09, 2.08, 2.07, 2.07, 2.06, 2.06, 2.06, 2.05, 2.05, 2.05, 2.04 };
+	int i = (int)df;
+	return i < 1 ? table[0] : (i <= 30 ? table[i - 1] : 1.96);
+}
+
+// Runs the bench command of two programs in turns, trials times each, and compares their
+// speed with a 95% confidence interval from Welch's t-test. Runs alternate so drift in the
+// machine's speed hits both alike. Returns 1 if B is significantly slower, else 0
+int compareBuilds(const string& a, const string& b, int trials, int depth, const string& record_path)
+{
+	// Fewer trials leave too few degrees of freedom for the interval to mean anything
+	if (trials < 3)
+	{
+		cout << "Usage: ChessSDL compare <program A> <program B> [trials] [depth], trials must be at least 3" << endl;
+		return 1;
+	}
+	vector<double> nps[2];
+	long long signature[2] = { -1, -1 };
+	const string builds[2] = { a, b };
+	for (int t = 0; t < trials; t++)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			string command = "\"" + builds[i] + "\" bench " + to_string(depth);
+#ifdef _WIN32
+			FILE* out = _popen(command.c_str(), "r");
+#else
+			FILE* out = popen(command.c_str(), "r");
+#endif
+			if (out == NULL)
+			{
+				cout << "Could not run " << builds[i] << endl;
+				return 1;
+			}
+			char line[512];
+			long long nodes = -1, ms = 0;
+			while (fgets(line, sizeof(line), out) != NULL)
+			{
+				sscanf(line, "Nodes: %lld Time: %lld ms", &nodes, &ms);
+			}
+#ifdef _WIN32
+			_pclose(out);
+#else
+			pclose(out);
+#endif
+			if (nodes < 0)
+			{
+				cout << "No bench result from " << builds[i] << endl;
+				return 1;
+			}
+			if (signature[i] != -1 && signature[i] != nodes)
+			{
+				cout << builds[i] << " gave different node counts between runs, the bench is not deterministic" << endl;
+			}
+			signature[i] = nodes;
+			nps[i].push_back(nodes * 1000.0 / max(ms, 1LL));
+			cout << "Trial " << t + 1 << " " << (i == 0 ? "A" : "B") << ": " << (long long)nps[i].back() << " nps" << endl;
+		}
+	}
+	double mean[2], variance[2];
+	for (int i = 0; i < 2; i++)
+	{
+		meanVariance(nps[i], mean[i], variance[i]);
+	}
+	// Welch's t-test on the difference of the means, degrees of freedom by Welch-Satterthwaite
+	double se2[2] = { variance[0] / trials, variance[1] / trials };
+	double se = sqrt(se2[0] + se2[1]);
+	double df = se2[0] + se2[1] > 0 ? pow(se2[0] + se2[1], 2) / (se2[0] * se2[0] / (trials - 1) + se2[1] * se2[1] / (trials - 1)) : 1;
+	double diff = mean[1] - mean[0];
+	double low = diff - tCritical(df) * se, high = diff + tCritical(df) * se;
+	cout << endl << "A: " << (long long)mean[0] << " nps +- " << (long long)sqrt(variance[0]) << ", signature " << signature[0] << endl;
+	cout << "B: " << (long long)mean[1] << " nps +- " << (long long)sqrt(variance[1]) << ", signature " << signature[1] << endl;
+	ostringstream change;
+	change << fixed << setprecision(2) << "B - A: " << diff / mean[0] * 100 << "% (95% interval " << low / mean[0] * 100 << "% to " << high / mean[0] * 100 << "%)";
+	cout << change.str() << endl;
+	if (signature[0] != signature[1])
+	{
+		cout << "Node signatures differ, the builds do not search the same tree" << endl;
+	}
+	// With no spread at all the interval is a point, which says nothing about the builds
+	bool slower = se > 0 && high < 0;
+	bool faster = se > 0 && low > 0;
+	cout << (slower ? "B is significantly slower" : (faster ? "B is significantly faster" : "No significant difference")) << endl;
+	if (!record_path.empty())
+	{
+		recordResult(record_path, "compare", "\"a\": \"" + jsonEscape(a) + "\", \"b\": \"" + jsonEscape(b) + "\", \"depth\": " + to_string(depth)
+			+ ", \"trials\": " + to_string(trials) + ", \"nps_a\": " + to_string(mean[0]) + ", \"nps_b\": " + to_string(mean[1])
+			+ ", \"change_low\": " + to_string(low / mean[0]) + ", \"change_high\": " + to_string(high / mean[0])
+			+ ", \"signature_a\": " + to_string(signature[0]) + ", \"signature_b\": " + to_string(signature[1]));
+	}
+	return slower ? 1 : 0;
+}
+
+// Resident set of the process in bytes, 0 where it cannot be read
+long long residentBytes()
+{
+#ifdef _WIN32
+	return 0;
+#else
+	ifstream in("/proc/self/statm");
+	long long total = 0, resident = 0;
+	in >> total >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// Plays games one after another to check that a long running engine does not grow. Boards
+// counted by the engine have to be back to the same bytes after every game, and the
+// resident set may not grow more than 16 MB once the first tenth of the games has warmed
+// up the allocator. Returns 0 if memory stayed flat
+int soak(int games, const string& options)
+{
+	Engine a, b;
+	a.hash_mb = 16;
+	b.hash_mb = 16;
+	a.configure(options);
+	b.configure(options);
+	const string start = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+	const int openings = sizeof(BENCH_POSITIONS) / sizeof(BENCH_POSITIONS[0]);
+	int warmup = max(1, games / 10);
+	long long baseline = -1, rss_start = 0;
+	bool grew = false;
+	for (int i = 0; i < games; i++)
+	{
+		playGame(i % 2 == 0 ? &a : &b, i % 2 == 0 ? &b : &a, BENCH_POSITIONS[i % openings], 400);
+		// Same position in both engines after every game, so the counts can be compared exactly
+		a.newGame(start);
+		b.newGame(start);
+		memory.flush();
+		long long live = memory.current[MEM_BOARDS];
+		if (baseline < 0)
+		{
+			baseline = live;
+		}
+		if (i + 1 == warmup)
+		{
+			rss_start = residentBytes();
+		}
+		if (live != baseline)
+		{
+			cout << "Game " << i + 1 << ": boards hold " << live << " bytes, " << live - baseline << " more than after the first game" << endl;
+			grew = true;
+		}
+		if ((i + 1) % warmup == 0 || i + 1 == games)
+		{
+			cout << "Game " << i + 1 << ": boards " << live << " bytes, resident " << residentBytes() / (1024 * 1024) << " MB" << endl;
+		}
+	}
+	long long rss_growth = residentBytes() - rss_start;
+	cout << endl;
+	memory.report(cout);
+	if (rss_start > 0)
+	{
+		cout << "Resident set grew " << rss_growth / 1024 << " KB after warmup" << endl;
+		grew = grew || rss_growth > 16 * 1024 * 1024;
+	}
+	cout << (grew ? "Memory grew" : "Memory stayed flat") << endl;
+	return grew ? 1 : 0;
+}
+
+// Depth-first proof-number search, used to find forced mates
+// Numbers are kept from the side to move's point of view: phi is the cost of proving the
+// side to move wins, delta the cost of proving it does not
+const unsigned int PN_INF = 100000000;
+
+struct ProofEntry
+{
+	unsigned long long key;
+	unsigned int phi;
+	unsigned int delta;
+};
+
+// A move of a position being expanded. The child board is only made with its moves when
+// the search goes into it, until then its key is enough to find its numbers
+struct ProofChild
+{
+	Move move;
+	unsigned long long key;
+	unsigned int phi;
+	unsigned int delta;
+};
+
+class MateSolver {
+public:
+	ProofEntry* table; // Fixed size, newer results replace older ones
+	size_t size;
+	bool attacker; // Side trying to deliver mate
+	long long nodes;
+	long long max_nodes;
+	long long max_ms;
+	bool aborted;
+	chrono::steady_clock::time_point start;
+
+	MateSolver(int mb = 64)
+	{
+		size_t size = 1;
+		while (size * 2 * sizeof(ProofEntry) <= (size_t)mb * 1024 * 1024)
+		{
+			size *= 2;
+		}
+		bool huge;
+		table = (ProofEntry*)allocLarge(size * sizeof(ProofEntry), huge, MEM_TABLES);
+		this->size = size;
+		nodes = 0;
+		max_nodes = 0;
+		max_ms = 0;
+		aborted = false;
+		attacker = true;
+	}
+	~MateSolver()
+	{
+		freeLarge(table, size * sizeof(ProofEntry), MEM_TABLES);
+	}
+	bool lookup(unsigned long long key, unsigned int& phi, unsigned int& delta)
+	{
+		ProofEntry& e = table[key & (size - 1)];
+		if (e.key != key)
+		{
+			return false;
+		}
+		phi = e.phi;
+		delta = e.delta;
+		return true;
+	}
+	void store(unsigned long long key, unsigned int phi, unsigned int delta)
+	{
+		ProofEntry& e = table[key & (size - 1)];
+		e.key = key;
+		e.phi = phi;
+		e.delta = delta;
+	}
+	// Sets the numbers of a finished position, returns 0 if the position is not finished,
+	// 1 if it is mate or stalemate and 2 for a draw that depends on the path taken to it
+	int terminal(Board* n, unsigned int& phi, unsigned int& delta)
+	{
+		int result;
+		if (n->moves.empty())
+		{
+			result = 1;
+			if (n->isCheck(n->turn))
+			{
+				// The side to move has been mated
+				phi = PN_INF;
+				delta = 0;
+				return result;
+			}
+		}
+		else if (n->isDraw())
+		{
+			result = 2;
+		}
+		else
+		{
+			return 0;
+		}
+		// Anything short of mate is a win for the defender
+		phi = n->turn == attacker ? PN_INF : 0;
+		delta = n->turn == attacker ? 0 : PN_INF;
+		return result;
+	}
+	// Numbers of a child that is already the last position in key_history
+	void childNumbers(Board* c, unsigned int& phi, unsigned int& delta)
+	{
+		if (terminal(c, phi, delta) == 0 && !lookup(c->key, phi, delta))
+		{
+			phi = 1;
+			delta = 1;
+		}
+	}
+	// Numbers of a child made without its moves. Only a check can be mate, so only those are
+	// made again with their moves to tell. The child is already the last position in key_history
+	void leafNumbers(Board* n, Move* m, Board* c, unsigned int& phi, unsigned int& delta)
+	{
+		if (c->isCheck(c->turn))
+		{
+			unique_ptr<Board> full(new Board(n, m->from_x, m->from_y, m->to_x, m->to_y, m->black_castling_l, m->black_castling_r, m->white_castling_l, m->white_castling_r, m->promotion_piece, m->en_passant));
+			childNumbers(full.get(), phi, delta);
+		}
+		else if (c->isDraw())
+		{
+			phi = c->turn == attacker ? PN_INF : 0;
+			delta = c->turn == attacker ? 0 : PN_INF;
+		}
+		else if (!lookup(c->key, phi, delta))
+		{
+			phi = 1;
+			delta = 1;
+		}
+	}
+	// Multiple iterative deepening, expands n until its numbers reach either threshold
+	void mid(Board* n, unsigned int th_phi, unsigned int th_delta, unsigned int& phi, unsigned int& delta)
+	{
+		nodes++;
+		if ((max_nodes > 0 && nodes >= max_nodes) || (max_ms > 0 && (nodes & 1023) == 0 && chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count() >= max_ms))
+		{
+			aborted = true;
+			return;
+		}
+		int t = terminal(n, phi, delta);
+		if (t != 0)
+		{
+			if (t == 1)
+			{
+				store(n->key, phi, delta);
+			}
+			return;
+		}
+		// Children are made without their moves, for their keys and whether they are in check
+		vector<ProofChild> children;
+		for (MoveList::iterator i = n->moves.begin(); i != n->moves.end(); i++)
+		{
+			unique_ptr<Board> c(new Board(n, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant, 0));
+			c->computeKey();
+			ProofChild child;
+			child.move = *i;
+			child.key = c->key;
+			key_history.push_back(c->key);
+			leafNumbers(n, &*i, c.get(), child.phi, child.delta);
+			key_history.pop_back();
+			children.push_back(child);
+		}
+		while (true)
+		{
+			// Side to move wins if any child loses, and loses only if every child wins
+			unsigned long long sum = 0;
+			size_t best = 0;
+			unsigned int delta2 = PN_INF;
+			phi = PN_INF;
+			for (size_t c = 0; c < children.size(); c++)
+			{
+				sum += children[c].phi;
+				if (children[c].delta < phi)
+				{
+					delta2 = phi;
+					phi = children[c].delta;
+					best = c;
+				}
+				else if (children[c].delta < delta2)
+				{
+					delta2 = children[c].delta;
+				}
+			}
+			delta = (unsigned int)min(sum, (unsigned long long)PN_INF);
+			if (phi >= th_phi || delta >= th_delta || aborted)
+			{
+				break;
+			}
+			// Search the most promising child until it is well past the second best. The 1 + 1/4
+			// margin lets it run a little longer so it is not expanded again as often
+			ProofChild& b = children[best];
+			unsigned long long th_child_phi = (unsigned long long)th_delta - delta + b.phi;
+			unsigned int th_child_delta = min(th_phi, delta2 >= PN_INF / 2 ? PN_INF : delta2 + delta2 / 4 + 1);
+			Move& m = b.move;
+			unique_ptr<Board> c(new Board(n, m.from_x, m.from_y, m.to_x, m.to_y, m.black_castling_l, m.black_castling_r, m.white_castling_l, m.white_castling_r, m.promotion_piece, m.en_passant));
+			key_history.push_back(c->key);
+			mid(c.get(), (unsigned int)min(th_child_phi, (unsigned long long)PN_INF), th_child_delta, b.phi, b.delta);
+			key_history.pop_back();
+		}
+		if (!aborted)
+		{
+			store(n->key, phi, delta);
+		}
+	}
+	// Looks for a forced mate for the side to move within the node and time budgets (0 for none)
+	// Returns 1 if a mate is proven, 0 if there is none and -1 if the budget ran out
+	// The mating line is written to line
+	int solve(Board* root, long long node_budget, long long ms_budget, vector<Move>& line)
+	{
+		unsigned int phi, delta;
+		attacker = root->turn;
+		max_nodes = node_budget;
+		max_ms = ms_budget;
+		nodes = 0;
+		aborted = false;
+		start = chrono::steady_clock::now();
+		key_history.push_back(root->key);
+		mid(root, PN_INF, PN_INF, phi, delta);
+		line.clear();
+		if (aborted || phi != 0)
+		{
+			key_history.pop_back();
+			return aborted ? -1 : 0;
+		}
+		// Follow proven children, the attacker plays a move that wins and the
+		// defender any move, preferring ones that do not get mated at once
+		Board* n = root;
+		Board* next;
+		Move chosen;
+		while (!n->moves.empty() && line.size() < 200)
+		{
+			next = NULL;
+			for (MoveList::iterator i = n->moves.begin(); i != n->moves.end(); i++)
+			{
+				Board* c = new Board(n, i->from_x, i->from_y, i->to_x, i->to_y, i->black_castling_l, i->black_castling_r, i->white_castling_l, i->white_castling_r, i->promotion_piece, i->en_passant);
+				unsigned int p, d;
+				key_history.push_back(c->key);
+				childNumbers(c, p, d);
+				key_history.pop_back();
+				bool proven = n->turn == attacker ? d == 0 : p == 0;
+				if (proven && (next == NULL || (n->turn != attacker && next->moves.empty())))
+				{
+					if (next != NULL)
+					{
+						delete next;
+					}
+					next = c;
+					chosen = *i;
+				}
+				else
+				{
+					delete c;
+				}
+				if (next == c && (n->turn == attacker || !c->moves.empty()))
+				{
+					break;
+				}
+			}
+			if (next == NULL)
+			{
+				break; // Table entry was overwritten, line ends early
+			}
+			line.push_back(chosen);
+			if (n != root)
+			{
+				delete n;
+			}
+			n = next;
+			key_history.push_back(n->key);
+		}
+		if (n != root)
+		{
+			delete n;
+		}
+		key_history.resize(key_history.size() - line.size() - 1);
+		return 1;
+	}
+};
+
+// Batch analysis spread over worker processes. The coordinator hands one position at a time
+// to each worker over a socket, so faster workers simply get more of them, puts the position
+// of a worker that dies back in the queue and prints results in input order as they complete
+// Workers are this program run as: worker <socket path or host:port> <depth> <ms>
+#ifndef _WIN32
+// Reads one line from a socket, keeping what follows it in buffer for the next call
+bool readLine(int fd, string& buffer, string& line)
+{
+	size_t end;
+	while ((end = buffer.find('\n')) == string::npos)
+	{
+		char chunk[4096];
+		ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+		if (got <= 0)
+		{
+			return false;
+		}
+		buffer.append(chunk, got);
+	}
+	line = buffer.substr(0, end);
+	buffer.erase(0, end + 1);
+	return true;
+}
+
+bool sendLine(int fd, const string& line)
+{
+	string data = line + "\n";
+	for (size_t sent = 0; sent < data.size();)
+	{
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0)
+		{
+			return false;
+		}
+		sent += n;
+	}
+	return true;
+}
+
+// Unix socket path, or host:port for TCP
+int connectTo(const string& endpoint)
+{
+	size_t colon = endpoint.rfind(':');
+	if (colon == string::npos)
+	{
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, endpoint.c_str(), sizeof(addr.sun_path) - 1);
+		if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+	addrinfo hints;
+	addrinfo* found;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(endpoint.substr(0, colon).c_str(), endpoint.substr(colon + 1).c_str(), &hints, &found) != 0)
+	{
+		return -1;
+	}
+	int fd = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+	if (connect(fd, found->ai_addr, found->ai_addrlen) != 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(found);
+	return fd;
+}
+
+// Worker side: searches each "index fen" it is sent and answers "index move eval nodes"
+int analysisWorker(const string& endpoint)
+{
+	int fd = connectTo(endpoint);
+	if (fd == -1)
+	{
+		cout << "Could not connect to " << endpoint << endl;
+		return 1;
+	}
+	string buffer, line;
+	while (readLine(fd, buffer, line) && line != "quit")
+	{
+		size_t space = line.find(' ');
+		string index = line.substr(0, space);
+		Board* b = new Board(line.substr(space + 1));
+		key_history.assign(1, b->key);
+		Board* result = think(b);
+		Move best = thinkMove(b, result);
+		string move = b->moves.empty() ? "none" : moveName(&best);
+		if (!sendLine(fd, index + " " + move + " " + to_string(engine->search_eval) + " " + to_string(engine->totals.total())))
+		{
+			break;
+		}
+		if (result != NULL && result != b)
+		{
+			delete result;
+		}
+		delete b;
 	}
-	// Evalutates Given position based on piece counts, and positions
-	void evaluate()
+	close(fd);
+	return 0;
+}
+
+// A worker process as the coordinator sees it
+struct AnalysisWorker
+{
+	int fd;
+	int assigned; // Position it is searching, -1 when idle
+	string buffer;
+};
+
+// Coordinator side. Starts local workers, and accepts remote ones too when listening on a port
+// Positions are retried on another worker up to 3 times before they are reported as failed.
+// Local workers that exit are restarted, up to twice their number in all
+int analysisCoordinator(const string& self, const string& file, int local_workers, int depth, int ms, int port)
+{
+	ifstream in(file);
+	if (!in)
 	{
-		int x, y, e = 0;
-		if (tables == NULL)
+		cout << "Could not open " << file << endl;
+		return 1;
+	}
+	// EPD lines start with the four position fields of a FEN, operations may follow
+	vector<string> fens, operations;
+	string line;
+	while (getline(in, line))
+	{
+		istringstream fields(line);
+		string f, fen, rest;
+		for (int i = 0; i < 4 && fields >> f; i++)
 		{
-			tables = generateTables();
+			fen += (i > 0 ? " " : "") + f;
 		}
-		// Count up given pieces as well as add points based on their piece tables
-		for (x = 0; x < 8; x++)
+		getline(fields, rest);
+		if (!fen.empty())
 		{
-			for (y = 0; y < 8; y++)
-			{
-				switch (squares[x][y])
-				{
-				case 1:
-					e -= PAWN;
-					e -= tables[(0 * 64) + (8 * (7 - x)) + y];
-					break;
-				case 2:
-					e -= BISHOP;
-					e -= tables[(1 * 64) + (8 * (7 - x)) + y];
-					break;
-				case 3:
-					e -= KNIGHT;
-					e -= tables[(2 * 64) + (8 * (7 - x)) + y];
-					break;
-				case 4:
-					e -= ROOK;
-					e -= tables[(3 * 64) + (8 * (7 - x)) + y];
-					break;
-				case 5:
-					e -= QUEEN;
-					e -= tables[(4 * 64) + (8 * (7 - x)) + y];
-					break;
-				case 11:
-					e += PAWN;
-					e += tables[(0 * 64) + (8 * x) + y];
-					break;
-				case 12:
-					e += BISHOP;
-					e += tables[(1 * 64) + (8 * x) + y];
-					break;
-				case 13:
-					e += KNIGHT;
-					e += tables[(2 * 64) + (8 * x) + y];
-					break;
-				case 14:
-					e += ROOK;
-					e += tables[(3 * 64) + (8 * x) + y];
-					break;
-				case 15:
-					e += QUEEN;
-					e += tables[(4 * 64) + (8 * x) + y];
-					break;
-				}
-			}
+			fens.push_back(fen);
+			operations.push_back(rest);
 		}
-		if (!turn)
+	}
+	int listener;
+	string endpoint;
+	if (port > 0)
+	{
+		listener = socket(AF_INET, SOCK_STREAM, 0);
+		int yes = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(port);
+		if (::bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0)
 		{
-			e = e * -1;
+			cout << "Could not listen on port " << port << endl;
+			return 1;
 		}
-		eval = e;
+		endpoint = "127.0.0.1:" + to_string(port);
 	}
-	// Main function for finding best moves
-	// Recursively searches d moves ahead using minmax function to find best move
-	// Also uses alpha beta pruning to avoid unnecessary calculations
-	Board* getBest(int d, int alpha, int beta, bool surface = false)
+	else
 	{
-		int al = alpha;
-		int bet = beta;
-		list<Board*> bestMoves;
-		Board* ret;
-		num_evaluated++;
-		if (d == 0)
+		endpoint = "/tmp/chess-analysis-" + to_string(getpid()) + ".sock";
+		unlink(endpoint.c_str());
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, endpoint.c_str(), sizeof(addr.sun_path) - 1);
+		if (::bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0)
 		{
-			return this;
+			cout << "Could not make socket " << endpoint << endl;
+			return 1;
 		}
-		eval = -10000000;
-		int mult = 1;
-		if (moves->empty())
+	}
+	listen(listener, 64);
+	int children = 0; // Local workers started and not reaped yet
+	auto spawn = [&]()
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			string d = to_string(depth), t = to_string(ms), h = to_string(engine->hash_mb);
+			execl(self.c_str(), self.c_str(), "worker", endpoint.c_str(), d.c_str(), t.c_str(), "--hash", h.c_str(), (char*)NULL);
+			_exit(127);
+		}
+		if (pid > 0)
+		{
+			children++;
+		}
+		return pid;
+	};
+	for (int i = 0; i < local_workers; i++)
+	{
+		spawn();
+	}
+	deque<int> pending;
+	for (int i = 0; i < (int)fens.size(); i++)
+	{
+		pending.push_back(i);
+	}
+	vector<string> results(fens.size());
+	vector<int> attempts(fens.size(), 0);
+	vector<AnalysisWorker> workers;
+	int printed = 0;
+	int done = 0;
+	int respawns = 0;
+	auto start = chrono::steady_clock::now();
+	// Hands the next position to an idle worker, false if it could not be sent
+	auto assign = [&](AnalysisWorker& w)
+	{
+		if (pending.empty())
+		{
+			return true;
+		}
+		w.assigned = pending.front();
+		pending.pop_front();
+		attempts[w.assigned]++;
+		return sendLine(w.fd, to_string(w.assigned) + " " + fens[w.assigned] + " 0 1");
+	};
+	auto lost = [&](AnalysisWorker& w)
+	{
+		close(w.fd);
+		if (w.assigned != -1)
 		{
-			if (!isCheck(turn))
+			if (attempts[w.assigned] < 3)
 			{
-				eval = 0;
+				pending.push_front(w.assigned);
+			}
+			else
+			{
+				results[w.assigned] = fens[w.assigned] + " c0 \"failed after 3 attempts\";" + operations[w.assigned];
+				done++;
+			}
+		}
+	};
+	int exit_code = 0;
+	while (done < (int)fens.size())
+	{
+		// Reap local workers that exited and start new ones in their place, within reason.
+		// Done by process rather than by connection, over TCP local and remote workers look the same
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+		{
+			children--;
+			if (respawns < 2 * local_workers)
+			{
+				respawns++;
+				spawn();
 			}
-			return this;
 		}
-		Board* b;
-		for (list<Move*>::iterator i = moves->begin(); i != moves->end(); i++)
+		// Nothing is left to search the positions, unless remote workers may still connect
+		if (workers.empty() && children == 0 && (port == 0 || local_workers > 0))
 		{
-			b = new Board(this, (*i)->from_x, (*i)->from_y, (*i)->to_x, (*i)->to_y, (*i)->black_castling_l, (*i)->black_castling_r, (*i)->white_castling_l, (*i)->white_castling_r, (*i)->promotion_piece, (*i)->en_passant);
-			b->getBest(d - 1, bet, al);
-			// Evaluate if this branch is prunable
-			// It will not be relevant for the depths above it so ignore it
-			if (b->eval < al)
+			cerr << "No workers left, unfinished positions:" << endl;
+			for (size_t i = 0; i < fens.size(); i++)
 			{
-				eval = 1000000;
-				for (auto& i : bestMoves)
+				if (results[i].empty())
 				{
-					freeBoard(i);
+					cerr << fens[i] << endl;
 				}
-				bestMoves.clear();
-				return NULL;
 			}
-			// If this is the current best move, clear the list and add this to it
-			if (eval < b->eval * -1)
+			exit_code = 1;
+			break;
+		}
+		vector<pollfd> fds(1);
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (auto& w : workers)
+		{
+			pollfd p;
+			p.fd = w.fd;
+			p.events = POLLIN;
+			fds.push_back(p);
+		}
+		if (poll(fds.data(), fds.size(), 1000) <= 0)
+		{
+			continue;
+		}
+		vector<AnalysisWorker> alive;
+		for (size_t i = 0; i < workers.size(); i++)
+		{
+			AnalysisWorker& w = workers[i];
+			bool ok = true;
+			if (fds[i + 1].revents != 0)
 			{
-				eval = b->eval * -1;
-				bet = eval;
-				for (auto& i : bestMoves)
+				string reply;
+				ok = readLine(w.fd, w.buffer, reply);
+				if (ok)
 				{
-					freeBoard(i);
+					istringstream fields(reply);
+					int index = -1;
+					string move;
+					long long eval, nodes;
+					// A reply that is malformed, or for another position than the one sent, drops the worker
+					if (!(fields >> index >> move >> eval >> nodes) || index < 0 || index >= (int)fens.size() || index != w.assigned)
+					{
+						cerr << "Bad reply from a worker: " << reply << endl;
+						ok = false;
+					}
+					else
+					{
+						results[index] = fens[index] + " bm " + move + "; ce " + to_string(eval) + "; acd " + to_string(depth) + "; acn " + to_string(nodes) + ";" + operations[index];
+						done++;
+						w.assigned = -1;
+						ok = assign(w);
+					}
 				}
-				bestMoves.clear();
-				bestMoves.push_back(b);
 			}
-			// If this is equally best move, add to list
-			else if (b->eval * -1 == eval)
+			if (ok)
 			{
-				bestMoves.push_back(b);
+				alive.push_back(w);
 			}
-			// Otherwise trash it
 			else
 			{
-				freeBoard(b);
+				lost(w);
 			}
 		}
-		if (moves->size() == 0)
+		workers = alive;
+		if (fds[0].revents & POLLIN)
 		{
-			eval = -1000000;
-			return NULL;
+			AnalysisWorker w;
+			w.fd = accept(listener, NULL, NULL);
+			w.assigned = -1;
+			if (w.fd != -1)
+			{
+				if (assign(w))
+				{
+					workers.push_back(w);
+				}
+				else
+				{
+					lost(w);
+				}
+			}
 		}
-		// Currently returns first move found of highest eval
-		ret = bestMoves.front();
-		for (auto& i : bestMoves)
+		// Idle workers pick up positions put back by lost ones
+		for (size_t i = 0; i < workers.size(); i++)
 		{
-			if (i != ret)
+			if (workers[i].assigned == -1 && !pending.empty() && !assign(workers[i]))
 			{
-				freeBoard(i);
+				AnalysisWorker w = workers[i];
+				workers.erase(workers.begin() + i);
+				i--;
+				lost(w);
 			}
 		}
-		bestMoves.clear();
-		return ret;
+		while (printed < (int)fens.size() && !results[printed].empty())
+		{
+			cout << results[printed++] << endl;
+		}
 	}
-};
+	for (auto& w : workers)
+	{
+		sendLine(w.fd, "quit");
+		close(w.fd);
+	}
+	// Closed before waiting, so workers still queued on it see the connection fail and exit
+	close(listener);
+	if (port == 0)
+	{
+		unlink(endpoint.c_str());
+	}
+	while (wait(NULL) > 0)
+	{
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cerr << "Positions: " << fens.size() << " Time: " << (long long)(seconds * 1000) << " ms Restarted workers: " << respawns << endl;
+	return exit_code;
+}
+#endif
 
 // Gets file paths of piece images
 string  getImgPath(int piece, int team)
@@ -936,9 +5962,9 @@ string  getImgPath(int piece, int team)
 	return buffer;
 }
 
+// Engine playing the game in the window, it holds the position shown
+Engine* game = NULL;
 // Other rendering variables for board
-Board* current_board = new Board();
-Board* next_board = NULL;
 SDL_Surface* images[12];
 SDL_Texture* textures[12];
 int selected[2]; // Player first click
@@ -946,7 +5972,14 @@ int to[2]; // Player second click
 int mouse_pos[2];
 bool mouse_down = false;
 
-int main() {
+int main(int argc, char* argv[]) {
+	// Headless commands run without opening a window
+	if (argc > 1)
+	{
+		return runCommand(argc, argv);
+	}
+	game = new Engine();
+	EngineScope scope(game);
 	fullscreen = false;
 	int flags = 0;
 	flags = SDL_WINDOW_RESIZABLE;
@@ -1024,7 +6057,7 @@ void handleEvents() {
 		case SDL_BUTTON_LEFT:
 			selected[0] = mouse_pos[0] / BOARD_SIZE;
 			selected[1] = mouse_pos[1] / BOARD_SIZE;
-			if (current_board->squares[selected[0]][selected[1]] != 0)
+			if (game->board->squares[selected[0]][selected[1]] != 0)
 			{
 				mouse_down = true;
 			}
@@ -1038,14 +6071,11 @@ void handleEvents() {
 			if (mouse_down)
 			{
 				mouse_down = false;
-				next_board = current_board->doMove(selected[0], selected[1], mouse_pos[0] / BOARD_SIZE, mouse_pos[1] / BOARD_SIZE);
-				// If players selected move is valid
-				if (next_board != current_board)
+				Move player(selected[0], selected[1], mouse_pos[0] / BOARD_SIZE, mouse_pos[1] / BOARD_SIZE, false, false, false, false);
+				// If players selected move is valid, make it
+				if (game->play(&player))
 				{
-					freeBoard(current_board);
-					// Make the move
-					current_board = next_board;
-					if (current_board->moves->size() == 0)
+					if (gameResult(game) != ONGOING)
 					{
 						render();
 						cout << "GAME OVER" << endl;
@@ -1055,12 +6085,21 @@ void handleEvents() {
 						}
 					}
 					render();
-					num_evaluated = 0;
 					// Computer makes next move
-					next_board = current_board->getBest(ENGINE_DEPTH, -100000, -100000, true);
-					freeBoard(current_board);
-					current_board = next_board;
-					if (current_board->moves->size() == 0)
+					Move reply = game->go();
+					game->printStats(cout);
+					cout << "Best line:";
+					for (auto& m : engine->search_line)
+					{
+						cout << " " << moveName(&m);
+					}
+					cout << " (" << engine->search_eval << ")" << endl;
+					bool played = game->play(&reply);
+					if (!played)
+					{
+						cout << "Engine found no legal move" << endl;
+					}
+					if (!played || gameResult(game) != ONGOING)
 					{
 						render();
 						cout << "GAME OVER" << endl;
@@ -1086,6 +6125,482 @@ void handleEvents() {
 	}
 }
 
+// Runs a command given on the command line
+//   mate <fen> [max nodes] [max ms] [table mb]   looks for a forced mate with proof-number search
+//   search <fen> [depth] [threads] [ms] [ybwc|mcts]  plays the engine's move from a position
+//   bench [depth] [hash mb]                      node count signature and speed over fixed positions,
+//                                                with --no-alloc exits with 1 if the search below the
+//                                                root allocated, needs a build with COUNT_ALLOCATIONS
+//   scaling [depth] [max threads] [ybwc]         bench speedup, node overhead and NPS over 1..n threads
+//   microbench [samples] [json file]             time per call of each board primitive
+//   soak [games] [settings]                      plays games in a row and fails if memory grows
+//   compare <program A> <program B> [trials] [depth]  runs the bench of two builds in turns and
+//                                                tests whether B is slower, exits with 1 if it is
+//   splitbench [depth] [max threads]             time to depth of Lazy SMP and YBWC over 1..n threads
+//   perft <depth> [fen] [threads] [split depth] [hash mb]  counts leaf positions, per root move
+//   perftsuite [max nodes] [threads] [hash mb]   checks perft counts of reference positions up to
+//                                                max nodes each, exits with 1 if any differ
+//   match <settings A> <settings B> [games] [threads] [openings file|-] [elo0] [elo1] [alpha] [beta]
+//                                                plays A against B until a sequential probability ratio
+//                                                test decides, settings as in Engine::configure
+//   concurrent [searches] [threads] [depth] [max nodes] [slice nodes]
+//                                                many resumable searches at once interleaved on a few
+//                                                threads, prints the total nodes per second
+//   games [games] [threads] [moves per game] [nodes per move] [slice nodes]
+//                                                the engine plays both sides of many games at once on
+//                                                the game manager, prints move latency and throughput
+//   unlinkhash <name>                            removes a shared hash left behind by --shared-hash
+//   analyze <epd file> [workers] [depth] [ms] [port]  searches every position of the file
+//                                                on worker processes, remote ones too with a port
+//   worker <socket path or host:port> [depth] [ms]  searches positions sent by a coordinator
+//   Options anywhere on the line: --pin (pin threads to cores), --numa (spread threads over
+//   NUMA nodes), --no-large-pages (normal pages for hash tables), --hash <mb>,
+//   --shared-hash <name> (attach to a transposition table shared with other processes),
+//   --trace <file> (write a timeline of the search threads for chrome://tracing or Perfetto),
+//   --record <file> (append bench, microbench and compare results with the build and machine),
+//   --no-alloc (fail the bench if the search below the root allocates)
+int runCommand(int argc, char* argv[])
+{
+	// Writes the trace on every way out of the command
+	struct TraceDump
+	{
+		string path;
+		~TraceDump()
+		{
+			if (!path.empty() && !tracer.dump(path))
+			{
+				cout << "Could not write trace to " << path << endl;
+			}
+		}
+	} trace;
+	Engine instance;
+	EngineScope scope(&instance);
+	// Take out the options so the commands only see their own arguments
+	string shared_hash, record_path;
+	bool no_alloc = false;
+	int n = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--pin")
+		{
+			engine->pin_threads = true;
+		}
+		else if (arg == "--numa")
+		{
+			engine->pin_threads = true;
+			engine->numa_interleave = true;
+		}
+		else if (arg == "--no-large-pages")
+		{
+			engine->large_pages = false;
+		}
+		else if (arg == "--hash" && i + 1 < argc)
+		{
+			engine->hash_mb = atoi(argv[++i]);
+		}
+		else if (arg == "--shared-hash" && i + 1 < argc)
+		{
+			shared_hash = argv[++i];
+		}
+		else if (arg == "--no-alloc")
+		{
+			no_alloc = true;
+		}
+		else if (arg == "--record" && i + 1 < argc)
+		{
+			record_path = argv[++i];
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			trace.path = argv[++i];
+			tracer.start(1 << 16);
+		}
+		else
+		{
+			argv[n++] = argv[i];
+		}
+	}
+	argc = n;
+	if (argc < 2)
+	{
+		return 1;
+	}
+	if (!shared_hash.empty() && !engine->tt.attach(shared_hash, engine->hash_mb))
+	{
+		cout << "Could not attach to shared hash " << shared_hash << ", using a private table" << endl;
+	}
+	string command = argv[1];
+	if (command == "unlinkhash" && argc > 2)
+	{
+		TranspositionTable::removeShared(argv[2]);
+		return 0;
+	}
+	if (command == "search" && argc > 2)
+	{
+		Board* b = new Board(argv[2]);
+		engine->depth = argc > 3 ? min(atoi(argv[3]), MAX_DEPTH) : engine->depth;
+		engine->threads = argc > 4 ? atoi(argv[4]) : engine->threads;
+		engine->time_ms = argc > 5 ? atoi(argv[5]) : engine->time_ms;
+		string backend = argc > 6 ? argv[6] : "";
+		engine->backend = backend == "ybwc" ? YBWC : (backend == "mcts" ? MCTS : LAZY_SMP);
+		key_history.push_back(b->key);
+		Board* result = think(b);
+		cout << "Best line:";
+		for (auto& m : engine->search_line)
+		{
+			cout << " " << moveName(&m);
+		}
+		cout << " (" << engine->search_eval << ")" << endl;
+		engine->printStats(cout);
+		cout << "Hash: " << engine->tt.size * sizeof(TTEntry) / (1024 * 1024) << " MB" << (engine->tt.huge ? " on large pages" : "") << (engine->tt.shared_name.empty() ? "" : " shared as " + engine->tt.shared_name) << endl;
+		if (result != NULL && result != b)
+		{
+			delete result;
+		}
+		delete b;
+		return 0;
+	}
+	if (command == "bench")
+	{
+		int depth = argc > 2 ? atoi(argv[2]) : 3;
+		engine->hash_mb = argc > 3 ? atoi(argv[3]) : engine->hash_mb;
+		BenchResult r = bench(depth, 1, LAZY_SMP, true);
+		cout << endl << "Nodes: " << r.nodes << " Time: " << (long long)(r.seconds * 1000) << " ms NPS: " << (long long)(r.nodes / max(r.seconds, 0.001)) << endl;
+#ifdef COUNT_ALLOCATIONS
+		cout << "Allocations: " << r.allocations << " (" << (double)r.allocations / max(r.nodes, 1LL) << " per node), "
+			<< r.hot_allocations << " below the root (" << (double)r.hot_allocations / max(r.nodes, 1LL) << " per node)" << endl;
+#endif
+		if (!record_path.empty())
+		{
+			string fields = "\"depth\": " + to_string(depth) + ", \"nodes\": " + to_string(r.nodes)
+				+ ", \"ms\": " + to_string((long long)(r.seconds * 1000)) + ", \"nps\": " + to_string((long long)(r.nodes / max(r.seconds, 0.001)));
+			ALLOC(fields += ", \"allocations\": " + to_string(r.allocations) + ", \"hot_allocations\": " + to_string(r.hot_allocations));
+			recordResult(record_path, "bench", fields);
+		}
+		if (no_alloc)
+		{
+#ifdef COUNT_ALLOCATIONS
+			if (r.hot_allocations > 0)
+			{
+				cout << "Failed: the search below the root allocated " << r.hot_allocations << " times" << endl;
+				return 1;
+			}
+#else
+			cout << "Failed: --no-alloc needs a build with COUNT_ALLOCATIONS defined" << endl;
+			return 1;
+#endif
+		}
+		return 0;
+	}
+	if (command == "scaling")
+	{
+		int depth = argc > 2 ? atoi(argv[2]) : 3;
+		int max_threads = argc > 3 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
+		scaling(depth, max_threads, argc > 4 && string(argv[4]) == "ybwc" ? YBWC : LAZY_SMP);
+		return 0;
+	}
+	if (command == "compare" && argc > 3)
+	{
+		return compareBuilds(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 10, argc > 5 ? atoi(argv[5]) : 3, record_path);
+	}
+	if (command == "microbench")
+	{
+		int samples = argc > 2 ? atoi(argv[2]) : 25;
+		vector<MicroResult> results = microbench(samples, argc > 3 ? argv[3] : "");
+		if (!record_path.empty())
+		{
+			string fields = "\"samples\": " + to_string(samples) + ", \"median_ns\": {";
+			for (size_t i = 0; i < results.size(); i++)
+			{
+				fields += (i > 0 ? ", \"" : "\"") + results[i].name + "\": " + to_string(percentile(results[i].ns, 0.5));
+			}
+			recordResult(record_path, "microbench", fields + "}");
+		}
+		return 0;
+	}
+	if (command == "match" && argc > 3)
+	{
+		Engine check;
+		if (!check.configure(argv[2]) || !check.configure(argv[3]))
+		{
+			cout << "Unknown setting in " << argv[2] << " or " << argv[3] << endl;
+			return 1;
+		}
+		int games = argc > 4 ? atoi(argv[4]) : 1000;
+		int threads = argc > 5 ? atoi(argv[5]) : (int)max(1u, thread::hardware_concurrency());
+		vector<string> openings;
+		if (argc > 6 && string(argv[6]) != "-")
+		{
+			ifstream in(argv[6]);
+			string line;
+			while (getline(in, line))
+			{
+				if (!line.empty() && line[0] != '#')
+				{
+					openings.push_back(line);
+				}
+			}
+		}
+		else
+		{
+			openings.assign(begin(BENCH_POSITIONS), end(BENCH_POSITIONS));
+		}
+		if (openings.empty())
+		{
+			cout << "No openings in " << argv[6] << endl;
+			return 1;
+		}
+		double elo0 = argc > 7 ? atof(argv[7]) : 0;
+		double elo1 = argc > 8 ? atof(argv[8]) : 10;
+		double alpha = argc > 9 ? atof(argv[9]) : 0.05;
+		double beta = argc > 10 ? atof(argv[10]) : 0.05;
+		runMatch(argv[2], argv[3], games, threads, openings, elo0, elo1, alpha, beta);
+		return 0;
+	}
+	if (command == "soak")
+	{
+		return soak(argc > 2 ? atoi(argv[2]) : 200, argc > 3 ? argv[3] : "depth=2");
+	}
+	if (command == "mate" && argc > 2)
+	{
+		Board* b = new Board(argv[2]);
+		long long node_budget = argc > 3 ? atoll(argv[3]) : 0;
+		long long ms_budget = argc > 4 ? atoll(argv[4]) : 0;
+		MateSolver solver(argc > 5 ? atoi(argv[5]) : 64);
+		vector<Move> line;
+		int result = solver.solve(b, node_budget, ms_budget, line);
+		long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - solver.start).count();
+		if (result == 1)
+		{
+			cout << "Mate in " << (line.size() + 1) / 2 << ":";
+			for (auto& m : line)
+			{
+				cout << " " << moveName(&m);
+			}
+			cout << endl;
+		}
+		else if (result == 0)
+		{
+			cout << "No forced mate" << endl;
+		}
+		else
+		{
+			cout << "Unknown, budget ran out" << endl;
+		}
+		cout << "Nodes: " << solver.nodes << " Time: " << ms << " ms" << endl;
+		delete b;
+		return result == -1 ? 2 : 0;
+	}
+	if (command == "perftsuite")
+	{
+		// Hash off by default so the counts check the move generator itself
+		unsigned long long max_nodes = argc > 2 ? strtoull(argv[2], NULL, 10) : 20000000;
+		int threads = argc > 3 ? atoi(argv[3]) : (int)max(1u, thread::hardware_concurrency());
+		int hash_mb = argc > 4 ? atoi(argv[4]) : 0;
+		return perftSuite(max_nodes, threads, hash_mb) == 0 ? 0 : 1;
+	}
+	if (command == "perft" && argc > 2)
+	{
+		int depth = atoi(argv[2]);
+		Board* b = argc > 3 ? new Board(argv[3]) : new Board();
+		int threads = argc > 4 ? atoi(argv[4]) : (int)max(1u, thread::hardware_concurrency());
+		int split = argc > 5 ? atoi(argv[5]) : 1;
+		int hash_mb = argc > 6 ? atoi(argv[6]) : 64;
+		vector<unsigned long long> divide;
+		auto start = chrono::steady_clock::now();
+		unsigned long long total = parallelPerft(b, depth, threads, split, hash_mb, divide);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		int index = 0;
+		for (auto& m : b->moves)
+		{
+			if (depth > 0)
+			{
+				cout << moveName(&m) << ": " << divide[index] << endl;
+			}
+			index++;
+		}
+		cout << endl << "Nodes: " << total << endl;
+		cout << "Time: " << (long long)(seconds * 1000) << " ms" << endl;
+		cout << "NPS: " << (long long)(total / max(seconds, 0.001)) << endl;
+		delete b;
+		return 0;
+	}
+	if (command == "splitbench")
+	{
+		// Same positions and depth for every thread count, table cleared before each search
+		const char* positions[] = {
+			"r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+			"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+			"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		};
+		engine->depth = argc > 2 ? atoi(argv[2]) : 4;
+		int max_threads = argc > 3 ? atoi(argv[3]) : (int)thread::hardware_concurrency();
+		engine->time_ms = 0;
+		double base[2] = { 0, 0 };
+		cout << "threads  lazy ms  speedup  nodes      ybwc ms  speedup  nodes" << endl;
+		for (int t = 1; t <= max(1, max_threads); t *= 2)
+		{
+			engine->threads = t;
+			cout << t;
+			for (int backend = 0; backend < 2; backend++)
+			{
+				engine->backend = backend == 0 ? LAZY_SMP : YBWC;
+				long long nodes = 0;
+				auto start = chrono::steady_clock::now();
+				for (auto& fen : positions)
+				{
+					Board* b = new Board(fen);
+					if (engine->tt.entries != NULL)
+					{
+						engine->tt.clear();
+					}
+					key_history.assign(1, b->key);
+					Board* result = think(b);
+					nodes += engine->totals.total();
+					if (result != b)
+					{
+						delete result;
+					}
+					delete b;
+				}
+				double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+				if (t == 1)
+				{
+					base[backend] = ms;
+				}
+				cout << "\t " << (long long)ms << "\t  " << base[backend] / ms << "\t   " << nodes << "\t";
+			}
+			cout << endl;
+		}
+		return 0;
+	}
+	if (command == "concurrent")
+	{
+		// Many searches at once on a few threads, cycling through a handful of positions
+		const char* positions[] = {
+			"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+			"r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+			"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+			"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		};
+		int count = argc > 2 ? atoi(argv[2]) : 1000;
+		int threads = argc > 3 ? atoi(argv[3]) : (int)max(1u, thread::hardware_concurrency());
+		int depth = argc > 4 ? atoi(argv[4]) : 4;
+		long long node_budget = argc > 5 ? atoll(argv[5]) : 0;
+		int slice = argc > 6 ? atoi(argv[6]) : 64;
+		if (engine->tt.entries == NULL)
+		{
+			engine->tt.resize(engine->hash_mb);
+		}
+		vector<Board*> boards;
+		vector<ResumableSearch*> searches;
+		for (int i = 0; i < count; i++)
+		{
+			Board* b = new Board(positions[i % 4]);
+			boards.push_back(b);
+			searches.push_back(new ResumableSearch(b, vector<unsigned long long>(1, b->key), depth, node_budget));
+		}
+		auto start = chrono::steady_clock::now();
+		{
+			SearchScheduler scheduler(threads, slice);
+			for (auto s : searches)
+			{
+				scheduler.add(s);
+			}
+			scheduler.wait();
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		long long nodes = 0;
+		for (int i = 0; i < count; i++)
+		{
+			nodes += searches[i]->nodes;
+			if (i < 4)
+			{
+				cout << positions[i] << ": " << moveName(&searches[i]->best) << " depth " << searches[i]->completed_depth << " (" << searches[i]->best_eval << ")" << endl;
+			}
+			delete searches[i];
+			delete boards[i];
+		}
+		cout << "Searches: " << count << " Threads: " << threads << endl;
+		cout << "Nodes: " << nodes << " Time: " << (long long)(seconds * 1000) << " ms" << endl;
+		cout << "NPS: " << (long long)(nodes / max(seconds, 0.001)) << endl;
+		return 0;
+	}
+	if (command == "games")
+	{
+		// The engine plays both sides of many games at once, each move queued after the last
+		int count = argc > 2 ? atoi(argv[2]) : 100;
+		int threads = argc > 3 ? atoi(argv[3]) : (int)max(1u, thread::hardware_concurrency());
+		int moves = argc > 4 ? atoi(argv[4]) : 10;
+		long long node_budget = argc > 5 ? atoll(argv[5]) : 1000;
+		int slice = argc > 6 ? atoi(argv[6]) : 64;
+		GameManager* manager = NULL;
+		manager = new GameManager(threads, slice, [&](Game* g, Move)
+		{
+			if (g->engine_moves < moves)
+			{
+				manager->requestMove(g->id);
+			}
+		});
+		for (int i = 0; i < count; i++)
+		{
+			manager->newGame("", 64, node_budget);
+		}
+		for (int i = 0; i < count; i++)
+		{
+			manager->requestMove(i);
+		}
+		manager->wait();
+		cout << "Games: " << count << " Threads: " << threads << endl;
+		manager->report(cout);
+		delete manager;
+		return 0;
+	}
+	if ((command == "analyze" && argc > 2) || (command == "worker" && argc > 2))
+	{
+#ifdef _WIN32
+		cout << "Distributed analysis needs POSIX sockets" << endl;
+		return 1;
+#else
+		if (command == "worker")
+		{
+			engine->depth = argc > 3 ? atoi(argv[3]) : engine->depth;
+			engine->time_ms = argc > 4 ? atoi(argv[4]) : engine->time_ms;
+			return analysisWorker(argv[2]);
+		}
+		engine->depth = argc > 4 ? atoi(argv[4]) : engine->depth;
+		engine->time_ms = argc > 5 ? atoi(argv[5]) : engine->time_ms;
+		// Workers are started from the same program file
+		char self[4096];
+		ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+		string path = len > 0 ? string(self, len) : string(argv[0]);
+		int workers = argc > 3 ? atoi(argv[3]) : (int)max(1u, thread::hardware_concurrency());
+		return analysisCoordinator(path, argv[2], workers, engine->depth, engine->time_ms, argc > 6 ? atoi(argv[6]) : 0);
+#endif
+	}
+	cout << "Usage: ChessSDL mate <fen> [max nodes] [max ms] [table mb]" << endl;
+	cout << "       ChessSDL search <fen> [depth] [threads] [ms] [ybwc|mcts]" << endl;
+	cout << "       ChessSDL bench [depth] [hash mb]" << endl;
+	cout << "       ChessSDL scaling [depth] [max threads] [ybwc]" << endl;
+	cout << "       ChessSDL microbench [samples] [json file]" << endl;
+	cout << "       ChessSDL soak [games] [settings]" << endl;
+	cout << "       ChessSDL compare <program A> <program B> [trials] [depth]" << endl;
+	cout << "       ChessSDL splitbench [depth] [max threads]" << endl;
+	cout << "       ChessSDL perft <depth> [fen] [threads] [split depth] [hash mb]" << endl;
+	cout << "       ChessSDL perftsuite [max nodes] [threads] [hash mb]" << endl;
+	cout << "       ChessSDL match <settings A> <settings B> [games] [threads] [openings file|-] [elo0] [elo1] [alpha] [beta]" << endl;
+	cout << "                settings are name=value pairs split by commas: depth ms nodes threads hash backend" << endl;
+	cout << "                delta pawn knight bishop rook queen" << endl;
+	cout << "       ChessSDL concurrent [searches] [threads] [depth] [max nodes] [slice nodes]" << endl;
+	cout << "       ChessSDL games [games] [threads] [moves per game] [nodes per move] [slice nodes]" << endl;
+	cout << "       ChessSDL unlinkhash <name>" << endl;
+	cout << "       ChessSDL analyze <epd file> [workers] [depth] [ms] [port]" << endl;
+	cout << "       ChessSDL worker <socket path or host:port> [depth] [ms]" << endl;
+	cout << "Options: --pin --numa --no-large-pages --hash <mb> --shared-hash <name> --trace <file> --record <file> --no-alloc" << endl;
+	return 1;
+}
+
 // Render graphics
 void render() {
 	SDL_SetRenderDrawColor(renderer, 121, 121, 121, 255);
@@ -1101,20 +6616,20 @@ void render() {
 			SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, 255);
 			SDL_RenderFillRect(renderer, &square);
 			// Draw non-selected pieces
-			if (current_board->squares[x][y] != 0)
+			if (game->board->squares[x][y] != 0)
 			{
 				if (x != selected[0] || y != selected[1] || mouse_down == false)
 				{
-					SDL_RenderCopy(renderer, textures[current_board->squares[x][y]%10 + (6 * (current_board->squares[x][y] / 10)) - 1], NULL, &square);
+					SDL_RenderCopy(renderer, textures[game->board->squares[x][y]%10 + (6 * (game->board->squares[x][y] / 10)) - 1], NULL, &square);
 				}
 			}
 		}
 	}
 	// If piece is selected, draw it last so it is on top
-	if (mouse_down && current_board->squares[selected[0]][selected[1]] != NULL)
+	if (mouse_down && game->board->squares[selected[0]][selected[1]] != NULL)
 	{
 		SDL_Rect moving = { mouse_pos[0] - (BOARD_SIZE / 2), mouse_pos[1] - (BOARD_SIZE / 2), BOARD_SIZE, BOARD_SIZE };
-		SDL_RenderCopy(renderer, textures[current_board->squares[selected[0]][selected[1]] % 10 + (6 * (current_board->squares[selected[0]][selected[1]] / 10)) - 1], NULL, &moving);
+		SDL_RenderCopy(renderer, textures[game->board->squares[selected[0]][selected[1]] % 10 + (6 * (game->board->squares[selected[0]][selected[1]] / 10)) - 1], NULL, &moving);
 	}
 
 
@@ -1129,9 +6644,10 @@ void update() {
 
 // Tables used to weight eval so that pieces are give higher or lower
 // values based on their position on the board. Positive is better, flipped per side
-int * generateTables()
+// Piece square tables every engine starts with
+vector<int> defaultTables()
 {
-	static int ret[6 * 64] =
+	static const int ret[6 * 64] =
 	{
 			// Pawn
 			0,  0,  0,  0,  0,  0,  0,  0,
@@ -1188,22 +6704,23 @@ int * generateTables()
 			 20, 20,  0,  0,  0,  0, 20, 20,
 			 20, 30, 10,  0,  0, 10, 30, 20
 	};
-	return ret;
+	return vector<int>(ret, ret + 6 * 64);
 }
 
-// Clean up board and child objects
-void freeBoard(Board* b)
+// Random keys used to hash positions, one per piece per square,
+// then side to move, the four castling rights and the eight en passant files
+// Made once on first use and never changed, so every engine and thread shares them
+const unsigned long long* zobristKeys()
 {
-	int x;
-	for (x = 0; x < 8; x++)
-	{
-		delete[] b->squares[x];
-	}
-	delete [] b->squares;
-	for (auto& i : *b->moves)
+	static const vector<unsigned long long> keys = []()
 	{
-		delete i;
-	}
-	delete b->moves;
-	delete b;
-}
\ No newline at end of file
+		vector<unsigned long long> ret((12 * 64) + 13);
+		mt19937_64 rng(20220407); // Fixed seed so keys are the same every run
+		for (auto& k : ret)
+		{
+			k = rng();
+		}
+		return ret;
+	}();
+	return keys.data();
+}